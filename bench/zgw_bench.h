@@ -0,0 +1,231 @@
+// Minimal microbenchmark harness, shaped after Google Benchmark.
+//
+// Include from exactly one file per bench binary: it replaces the global
+// operator new to count allocations and defines main().
+//
+//   static void BM_Foo(BenchState& state) {
+//     while (state.KeepRunning()) {
+//       Foo(state.arg());
+//     }
+//   }
+//   ZGW_BENCH_ARGS(BM_Foo, 1000, 100000);
+//
+// Run with a substring of the benchmark names to run only those, and
+// --min_time=<seconds> to change the time spent on each.
+#ifndef ZGW_BENCH_H
+#define ZGW_BENCH_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <new>
+
+namespace zgw_bench {
+
+struct AllocCounter {
+  std::atomic<uint64_t> allocs;
+  std::atomic<uint64_t> bytes;
+};
+
+inline AllocCounter* Allocs() {
+  static AllocCounter counter;
+  return &counter;
+}
+
+class BenchState {
+ public:
+  BenchState(uint64_t iterations, int64_t arg)
+      : iterations_(iterations),
+        left_(iterations),
+        arg_(arg),
+        started_(false),
+        paused_(true),
+        elapsed_ns_(0),
+        allocs_(0),
+        bytes_(0),
+        start_allocs_(0),
+        start_bytes_(0) {
+  }
+
+  bool KeepRunning() {
+    if (!started_) {
+      started_ = true;
+      Resume();
+    }
+    if (left_ == 0) {
+      Pause();
+      return false;
+    }
+    left_--;
+    return true;
+  }
+
+  // Leave setup work out of the timing and allocation counts
+  void PauseTiming() {
+    Pause();
+  }
+  void ResumeTiming() {
+    Resume();
+  }
+
+  int64_t arg() const {
+    return arg_;
+  }
+  uint64_t iterations() const {
+    return iterations_;
+  }
+  double elapsed_ns() const {
+    return elapsed_ns_;
+  }
+  uint64_t allocs() const {
+    return allocs_;
+  }
+  uint64_t bytes() const {
+    return bytes_;
+  }
+
+ private:
+  uint64_t iterations_;
+  uint64_t left_;
+  int64_t arg_;
+  bool started_;
+  bool paused_;
+  double elapsed_ns_;
+  uint64_t allocs_;
+  uint64_t bytes_;
+  uint64_t start_allocs_;
+  uint64_t start_bytes_;
+  std::chrono::steady_clock::time_point start_;
+
+  void Resume() {
+    paused_ = false;
+    start_allocs_ = Allocs()->allocs.load(std::memory_order_relaxed);
+    start_bytes_ = Allocs()->bytes.load(std::memory_order_relaxed);
+    start_ = std::chrono::steady_clock::now();
+  }
+
+  void Pause() {
+    if (paused_) {
+      return;
+    }
+    std::chrono::duration<double, std::nano> diff =
+      std::chrono::steady_clock::now() - start_;
+    elapsed_ns_ += diff.count();
+    allocs_ += Allocs()->allocs.load(std::memory_order_relaxed) - start_allocs_;
+    bytes_ += Allocs()->bytes.load(std::memory_order_relaxed) - start_bytes_;
+    paused_ = true;
+  }
+};
+
+typedef void (*BenchFunc)(BenchState&);
+
+struct Bench {
+  std::string name;
+  BenchFunc func;
+  std::vector<int64_t> args;
+};
+
+inline std::vector<Bench>* Benches() {
+  static std::vector<Bench> benches;
+  return &benches;
+}
+
+struct BenchRegistrar {
+  BenchRegistrar(const char* name, BenchFunc func,
+                 std::vector<int64_t> args = std::vector<int64_t>()) {
+    Benches()->push_back(Bench{name, func, args});
+  }
+};
+
+inline void RunBench(const std::string& name, BenchFunc func, int64_t arg,
+                     double min_time_ns) {
+  // Grow the iteration count until a run takes long enough to trust
+  uint64_t iterations = 1;
+  while (true) {
+    BenchState state(iterations, arg);
+    func(state);
+    if (state.elapsed_ns() >= min_time_ns || iterations >= (1ULL << 32)) {
+      printf("%-40s %12lu %14.1f %12.1f %14.1f\n", name.c_str(),
+             static_cast<unsigned long>(iterations),
+             state.elapsed_ns() / iterations,
+             static_cast<double>(state.allocs()) / iterations,
+             static_cast<double>(state.bytes()) / iterations);
+      fflush(stdout);
+      return;
+    }
+    double scale = state.elapsed_ns() > 0
+      ? min_time_ns * 1.4 / state.elapsed_ns() : 100;
+    if (scale > 100) {
+      scale = 100;
+    }
+    uint64_t next = static_cast<uint64_t>(iterations * scale);
+    iterations = next > iterations ? next : iterations + 1;
+  }
+}
+
+inline int RunAll(int argc, char* argv[]) {
+  double min_time = 0.5;
+  std::string filter;
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--min_time=", 11) == 0) {
+      min_time = atof(argv[i] + 11);
+    } else {
+      filter = argv[i];
+    }
+  }
+
+  printf("%-40s %12s %14s %12s %14s\n", "Benchmark", "Iterations",
+         "ns/op", "allocs/op", "bytes/op");
+  for (auto& bench : *Benches()) {
+    if (bench.args.empty()) {
+      if (bench.name.find(filter) != std::string::npos) {
+        RunBench(bench.name, bench.func, 0, min_time * 1e9);
+      }
+      continue;
+    }
+    for (int64_t arg : bench.args) {
+      std::string name = bench.name + "/" + std::to_string(arg);
+      if (name.find(filter) != std::string::npos) {
+        RunBench(name, bench.func, arg, min_time * 1e9);
+      }
+    }
+  }
+  return 0;
+}
+
+}  // namespace zgw_bench
+
+// Out of line, so the compiler does not pair the malloc and free itself
+__attribute__((noinline)) void* operator new(size_t size) {
+  zgw_bench::Allocs()->allocs.fetch_add(1, std::memory_order_relaxed);
+  zgw_bench::Allocs()->bytes.fetch_add(size, std::memory_order_relaxed);
+  void* p = malloc(size == 0 ? 1 : size);
+  if (p == NULL) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+  free(p);
+}
+
+#define ZGW_BENCH_CONCAT2(a, b) a##b
+#define ZGW_BENCH_CONCAT(a, b) ZGW_BENCH_CONCAT2(a, b)
+
+#define ZGW_BENCH(func) \
+  static zgw_bench::BenchRegistrar ZGW_BENCH_CONCAT(bench_, __LINE__)(#func, func)
+
+#define ZGW_BENCH_ARGS(func, ...) \
+  static zgw_bench::BenchRegistrar ZGW_BENCH_CONCAT(bench_, __LINE__)( \
+      #func, func, std::vector<int64_t>{__VA_ARGS__})
+
+int main(int argc, char* argv[]) {
+  return zgw_bench::RunAll(argc, argv);
+}
+
+#endif  // ZGW_BENCH_H
@@ -0,0 +1,556 @@
+// End to end load generator: drives a mix of PUT, GET and LIST object
+// requests against a running gateway and reports throughput and latency
+// percentiles per operation.
+//
+// Run the gateway with "backend: memory" to measure the gateway alone:
+//
+//   ./bench/zgw_loadgen --threads=16 --duration=30 --object_size=4096
+//       --objects=10000 --mix=45:45:10
+//
+// Without --access_key a user is created through the admin port.
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <map>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+#include "pink/include/http_conn.h"
+#include "src/zgw_auth.h"
+
+struct LoadOptions {
+  std::string host;
+  int port;
+  int admin_port;
+  std::string access_key;
+  std::string secret_key;
+  // zgw-loadgen-<pid> if empty
+  std::string bucket;
+  int threads;
+  int duration;
+  int object_size;
+  int objects;
+  // Weights of PUT, GET and LIST
+  int put_weight;
+  int get_weight;
+  int list_weight;
+  int list_max_keys;
+
+  LoadOptions()
+      : host("127.0.0.1"),
+        port(8099),
+        admin_port(8199),
+        threads(8),
+        duration(10),
+        object_size(4096),
+        objects(1000),
+        put_weight(45),
+        get_weight(45),
+        list_weight(10),
+        list_max_keys(100) {
+  }
+};
+
+enum LoadOp {
+  kPut = 0,
+  kGet,
+  kList,
+  kLoadOpCount,
+};
+
+static const char* kLoadOpNames[kLoadOpCount] = {"PUT", "GET", "LIST"};
+
+static uint64_t NowMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// One keep alive connection, reconnected when the server closes it
+class HttpClient {
+ public:
+  HttpClient(const std::string& host, int port)
+      : host_(host),
+        port_(port),
+        fd_(-1) {
+  }
+
+  ~HttpClient() {
+    Close();
+  }
+
+  // Signed with access_key unless it is empty. False on a network error
+  bool Do(const std::string& method, const std::string& path,
+          const std::map<std::string, std::string>& query_params,
+          const std::string& body,
+          const std::string& access_key, const std::string& secret_key,
+          int* status, std::string* resp_body);
+
+ private:
+  std::string host_;
+  int port_;
+  int fd_;
+  std::string rbuf_;
+
+  bool Connect();
+  void Close();
+  bool SendAll(const std::string& data);
+  bool ReadResponse(int* status, std::string* body, bool* keep_alive);
+
+  // No copying allowed
+  HttpClient(const HttpClient&);
+  void operator=(const HttpClient&);
+};
+
+bool HttpClient::Connect() {
+  addrinfo hints, *res;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  std::string port = std::to_string(port_);
+  if (getaddrinfo(host_.c_str(), port.c_str(), &hints, &res) != 0) {
+    return false;
+  }
+  fd_ = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+  if (fd_ < 0 || connect(fd_, res->ai_addr, res->ai_addrlen) != 0) {
+    freeaddrinfo(res);
+    Close();
+    return false;
+  }
+  freeaddrinfo(res);
+  int one = 1;
+  setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  rbuf_.clear();
+  return true;
+}
+
+void HttpClient::Close() {
+  if (fd_ >= 0) {
+    close(fd_);
+    fd_ = -1;
+  }
+}
+
+bool HttpClient::SendAll(const std::string& data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    ssize_t n = send(fd_, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (n <= 0) {
+      return false;
+    }
+    sent += n;
+  }
+  return true;
+}
+
+bool HttpClient::ReadResponse(int* status, std::string* body,
+                              bool* keep_alive) {
+  char buf[64 * 1024];
+  size_t header_end;
+  while ((header_end = rbuf_.find("\r\n\r\n")) == std::string::npos) {
+    ssize_t n = recv(fd_, buf, sizeof(buf), 0);
+    if (n <= 0) {
+      return false;
+    }
+    rbuf_.append(buf, n);
+  }
+
+  // HTTP/1.1 200 OK
+  size_t sp = rbuf_.find(' ');
+  if (sp == std::string::npos || sp > header_end) {
+    return false;
+  }
+  *status = atoi(rbuf_.c_str() + sp + 1);
+
+  int64_t content_length = -1;
+  *keep_alive = true;
+  size_t pos = rbuf_.find("\r\n") + 2;
+  while (pos < header_end) {
+    size_t eol = rbuf_.find("\r\n", pos);
+    size_t colon = rbuf_.find(':', pos);
+    if (colon != std::string::npos && colon < eol) {
+      std::string name = rbuf_.substr(pos, colon - pos);
+      std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+      size_t v = rbuf_.find_first_not_of(' ', colon + 1);
+      std::string value = rbuf_.substr(v, eol - v);
+      if (name == "content-length") {
+        content_length = strtoll(value.c_str(), NULL, 10);
+      } else if (name == "connection" && strcasecmp(value.c_str(), "close") == 0) {
+        *keep_alive = false;
+      }
+    }
+    pos = eol + 2;
+  }
+  rbuf_.erase(0, header_end + 4);
+
+  if (content_length < 0) {
+    // Body runs to the end of the connection
+    *keep_alive = false;
+    while (true) {
+      ssize_t n = recv(fd_, buf, sizeof(buf), 0);
+      if (n <= 0) {
+        break;
+      }
+      rbuf_.append(buf, n);
+    }
+    content_length = rbuf_.size();
+  }
+  while (rbuf_.size() < static_cast<size_t>(content_length)) {
+    ssize_t n = recv(fd_, buf, sizeof(buf), 0);
+    if (n <= 0) {
+      return false;
+    }
+    rbuf_.append(buf, n);
+  }
+  body->assign(rbuf_, 0, content_length);
+  rbuf_.erase(0, content_length);
+  return true;
+}
+
+bool HttpClient::Do(const std::string& method, const std::string& path,
+                    const std::map<std::string, std::string>& query_params,
+                    const std::string& body,
+                    const std::string& access_key, const std::string& secret_key,
+                    int* status, std::string* resp_body) {
+  pink::HttpRequest req;
+  req.method = method;
+  req.path = path;
+  req.query_params = query_params;
+  req.headers["host"] = host_ + ":" + std::to_string(port_);
+  if (!access_key.empty()) {
+    char iso_date[32];
+    time_t now = time(NULL);
+    tm t;
+    gmtime_r(&now, &t);
+    strftime(iso_date, sizeof(iso_date), "%Y%m%dT%H%M%SZ", &t);
+    if (!ZgwAuth::Sign(&req, access_key, secret_key, iso_date)) {
+      return false;
+    }
+  }
+
+  std::string data = method + " " + UrlEncode(path);
+  char sep = '?';
+  for (auto& q : query_params) {
+    data.append(1, sep).append(UrlEncode(q.first, true)).append("=")
+      .append(UrlEncode(q.second, true));
+    sep = '&';
+  }
+  data.append(" HTTP/1.1\r\n");
+  for (auto& h : req.headers) {
+    data.append(h.first + ": " + h.second + "\r\n");
+  }
+  data.append("content-length: " + std::to_string(body.size()) + "\r\n\r\n");
+  data.append(body);
+
+  // A kept alive connection may have been closed since the last request,
+  // retry once on a new one
+  for (int attempt = 0; attempt < 2; attempt++) {
+    bool reused = fd_ >= 0;
+    if (!reused && !Connect()) {
+      return false;
+    }
+    bool keep_alive;
+    if (SendAll(data) && ReadResponse(status, resp_body, &keep_alive)) {
+      if (!keep_alive) {
+        Close();
+      }
+      return true;
+    }
+    Close();
+    if (!reused) {
+      break;
+    }
+  }
+  return false;
+}
+
+struct OpStats {
+  // Microseconds of every finished request
+  std::vector<uint64_t> latencies;
+  uint64_t errors;
+  uint64_t bytes;
+
+  OpStats()
+      : errors(0),
+        bytes(0) {
+  }
+};
+
+struct WorkerStats {
+  OpStats ops[kLoadOpCount];
+};
+
+static std::string ObjectPath(const LoadOptions& options, int i) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "obj-%08d", i);
+  return "/" + options.bucket + "/loadgen/" + buf;
+}
+
+static uint64_t NextRand(uint64_t* state) {
+  // xorshift64
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+static void Populate(const LoadOptions& options, int id,
+                     std::atomic<int>* failed) {
+  HttpClient client(options.host, options.port);
+  const std::string body(options.object_size, 'x');
+  std::map<std::string, std::string> no_params;
+  int status;
+  std::string resp;
+  for (int i = id; i < options.objects; i += options.threads) {
+    if (!client.Do("PUT", ObjectPath(options, i), no_params, body,
+                   options.access_key, options.secret_key, &status, &resp) ||
+        status != 200) {
+      failed->fetch_add(1);
+    }
+  }
+}
+
+static void RunWorker(const LoadOptions& options, int id, uint64_t end_us,
+                      WorkerStats* stats) {
+  HttpClient client(options.host, options.port);
+  const std::string body(options.object_size, 'x');
+  const std::string empty;
+  std::map<std::string, std::string> no_params;
+  std::map<std::string, std::string> list_params;
+  list_params["max-keys"] = std::to_string(options.list_max_keys);
+  list_params["prefix"] = "loadgen/";
+  int total_weight = options.put_weight + options.get_weight +
+    options.list_weight;
+  uint64_t rand_state = NowMicros() * (id + 1) | 1;
+  int status;
+  std::string resp;
+
+  while (NowMicros() < end_us) {
+    int w = NextRand(&rand_state) % total_weight;
+    LoadOp op = w < options.put_weight ? kPut
+      : w < options.put_weight + options.get_weight ? kGet : kList;
+    int object = NextRand(&rand_state) % options.objects;
+
+    uint64_t start_us = NowMicros();
+    bool ok;
+    switch (op) {
+      case kPut:
+        ok = client.Do("PUT", ObjectPath(options, object), no_params, body,
+                       options.access_key, options.secret_key, &status, &resp);
+        break;
+      case kGet:
+        ok = client.Do("GET", ObjectPath(options, object), no_params, empty,
+                       options.access_key, options.secret_key, &status, &resp);
+        break;
+      default:
+        ok = client.Do("GET", "/" + options.bucket, list_params, empty,
+                       options.access_key, options.secret_key, &status, &resp);
+        break;
+    }
+    OpStats& op_stats = stats->ops[op];
+    op_stats.latencies.push_back(NowMicros() - start_us);
+    if (!ok || status != 200) {
+      op_stats.errors++;
+    } else {
+      op_stats.bytes += op == kPut ? body.size() : resp.size();
+    }
+  }
+}
+
+static uint64_t Percentile(const std::vector<uint64_t>& sorted, double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  size_t i = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+  return sorted[i];
+}
+
+static void Report(const std::vector<WorkerStats>& stats, double seconds) {
+  printf("%-6s %10s %8s %10s %9s %10s %10s %10s %10s\n", "op", "requests",
+         "errors", "req/s", "MB/s", "p50(us)", "p99(us)", "p999(us)",
+         "max(us)");
+  uint64_t total = 0;
+  for (int op = 0; op < kLoadOpCount; op++) {
+    OpStats merged;
+    for (auto& s : stats) {
+      const OpStats& o = s.ops[op];
+      merged.latencies.insert(merged.latencies.end(), o.latencies.begin(),
+                              o.latencies.end());
+      merged.errors += o.errors;
+      merged.bytes += o.bytes;
+    }
+    std::sort(merged.latencies.begin(), merged.latencies.end());
+    uint64_t count = merged.latencies.size();
+    total += count;
+    printf("%-6s %10lu %8lu %10.1f %9.2f %10lu %10lu %10lu %10lu\n",
+           kLoadOpNames[op], static_cast<unsigned long>(count),
+           static_cast<unsigned long>(merged.errors), count / seconds,
+           merged.bytes / seconds / (1 << 20),
+           static_cast<unsigned long>(Percentile(merged.latencies, 0.5)),
+           static_cast<unsigned long>(Percentile(merged.latencies, 0.99)),
+           static_cast<unsigned long>(Percentile(merged.latencies, 0.999)),
+           static_cast<unsigned long>(count ? merged.latencies.back() : 0));
+  }
+  printf("total %lu requests in %.1fs, %.1f req/s\n",
+         static_cast<unsigned long>(total), seconds, total / seconds);
+}
+
+static bool ParseMix(const std::string& mix, LoadOptions* options) {
+  return sscanf(mix.c_str(), "%d:%d:%d", &options->put_weight,
+                &options->get_weight, &options->list_weight) == 3 &&
+    options->put_weight >= 0 && options->get_weight >= 0 &&
+    options->list_weight >= 0 &&
+    options->put_weight + options->get_weight + options->list_weight > 0;
+}
+
+static void Usage() {
+  fprintf(stderr,
+          "Usage: zgw_loadgen [--host=127.0.0.1] [--port=8099]"
+          " [--admin_port=8199]\n"
+          "         [--access_key=K --secret_key=S] [--bucket=B]\n"
+          "         [--threads=8] [--duration=10] [--object_size=4096]\n"
+          "         [--objects=1000] [--mix=put:get:list] [--list_max_keys=100]\n");
+}
+
+static bool ParseArgs(int argc, char* argv[], LoadOptions* options) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    size_t eq = arg.find('=');
+    if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos) {
+      return false;
+    }
+    std::string name = arg.substr(2, eq - 2);
+    std::string value = arg.substr(eq + 1);
+    if (name == "host") {
+      options->host = value;
+    } else if (name == "port") {
+      options->port = atoi(value.c_str());
+    } else if (name == "admin_port") {
+      options->admin_port = atoi(value.c_str());
+    } else if (name == "access_key") {
+      options->access_key = value;
+    } else if (name == "secret_key") {
+      options->secret_key = value;
+    } else if (name == "bucket") {
+      options->bucket = value;
+    } else if (name == "threads") {
+      options->threads = atoi(value.c_str());
+    } else if (name == "duration") {
+      options->duration = atoi(value.c_str());
+    } else if (name == "object_size") {
+      options->object_size = atoi(value.c_str());
+    } else if (name == "objects") {
+      options->objects = atoi(value.c_str());
+    } else if (name == "mix") {
+      if (!ParseMix(value, options)) {
+        return false;
+      }
+    } else if (name == "list_max_keys") {
+      options->list_max_keys = atoi(value.c_str());
+    } else {
+      return false;
+    }
+  }
+  return options->threads > 0 && options->duration > 0 &&
+    options->object_size >= 0 && options->objects > 0 &&
+    options->access_key.empty() == options->secret_key.empty();
+}
+
+// Admin port answers "<access key>\r\n<secret key>"
+static bool CreateUser(LoadOptions* options) {
+  HttpClient admin(options->host, options->admin_port);
+  std::map<std::string, std::string> no_params;
+  int status;
+  std::string resp;
+  char user[64];
+  snprintf(user, sizeof(user), "/admin_put_user/loadgen-%d",
+           static_cast<int>(getpid()));
+  if (!admin.Do("PUT", user, no_params, "", "", "", &status, &resp) ||
+      status != 200) {
+    return false;
+  }
+  size_t pos = resp.find("\r\n");
+  if (pos == std::string::npos) {
+    return false;
+  }
+  options->access_key = resp.substr(0, pos);
+  options->secret_key = resp.substr(pos + 2);
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  LoadOptions options;
+  if (!ParseArgs(argc, argv, &options)) {
+    Usage();
+    return 1;
+  }
+
+  if (options.bucket.empty()) {
+    options.bucket = "zgw-loadgen-" + std::to_string(getpid());
+  }
+  if (options.access_key.empty() && !CreateUser(&options)) {
+    fprintf(stderr, "Create user on %s:%d failed\n", options.host.c_str(),
+            options.admin_port);
+    return 1;
+  }
+
+  HttpClient client(options.host, options.port);
+  std::map<std::string, std::string> no_params;
+  int status;
+  std::string resp;
+  if (!client.Do("PUT", "/" + options.bucket, no_params, "",
+                 options.access_key, options.secret_key, &status, &resp)) {
+    fprintf(stderr, "Connect to %s:%d failed\n", options.host.c_str(),
+            options.port);
+    return 1;
+  }
+  // Left from an earlier run with the same keys
+  if (status != 200 &&
+      !(status == 409 &&
+        resp.find("BucketAlreadyOwnedByYou") != std::string::npos)) {
+    fprintf(stderr, "Create bucket failed: %d %s\n", status, resp.c_str());
+    return 1;
+  }
+
+  printf("Writing %d objects of %d bytes\n", options.objects,
+         options.object_size);
+  std::atomic<int> failed(0);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < options.threads; i++) {
+    threads.push_back(std::thread(Populate, std::cref(options), i, &failed));
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  threads.clear();
+  if (failed.load() > 0) {
+    fprintf(stderr, "%d objects failed to write\n", failed.load());
+    return 1;
+  }
+
+  printf("Running %d threads for %ds, mix %d:%d:%d\n", options.threads,
+         options.duration, options.put_weight, options.get_weight,
+         options.list_weight);
+  std::vector<WorkerStats> stats(options.threads);
+  uint64_t start_us = NowMicros();
+  uint64_t end_us = start_us + options.duration * 1000000ULL;
+  for (int i = 0; i < options.threads; i++) {
+    threads.push_back(std::thread(RunWorker, std::cref(options), i, end_us,
+                                  &stats[i]));
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  Report(stats, (NowMicros() - start_us) / 1e6);
+  return 0;
+}
@@ -0,0 +1,143 @@
+#include "src/libzgw/zgw_backend.h"
+
+#include <unistd.h>
+#include <functional>
+
+#include "slash/include/env.h"
+
+namespace libzgw {
+
+void ZpBackend::WaitForNewTables() {
+  // Partitions of a new table take a while to get their nodes
+  sleep(10);
+}
+
+Status MemStore::ListTable(std::vector<std::string>* tables) {
+  std::lock_guard<std::mutex> lock(tables_mu_);
+  tables->assign(tables_.begin(), tables_.end());
+  return Status::OK();
+}
+
+Status MemStore::CreateTable(const std::string& table) {
+  std::lock_guard<std::mutex> lock(tables_mu_);
+  tables_.insert(table);
+  return Status::OK();
+}
+
+MemStore::Shard* MemStore::FindShard(const std::string& table,
+                                     const std::string& key,
+                                     std::string* full_key) {
+  full_key->reserve(table.size() + 1 + key.size());
+  full_key->assign(table).append(1, '\0').append(key);
+  return &shards_[std::hash<std::string>()(*full_key) % kMemStoreShards];
+}
+
+Status MemStore::Set(const std::string& table, const std::string& key,
+                     const std::string& value) {
+  std::string full_key;
+  Shard* shard = FindShard(table, key, &full_key);
+  std::shared_ptr<const std::string> v = std::make_shared<const std::string>(value);
+  {
+    std::lock_guard<std::mutex> lock(shard->mu);
+    shard->kvs[full_key].swap(v);
+  }
+  return Status::OK();
+}
+
+Status MemStore::Get(const std::string& table, const std::string& key,
+                     std::string* value) {
+  std::string full_key;
+  Shard* shard = FindShard(table, key, &full_key);
+  std::shared_ptr<const std::string> v;
+  {
+    std::lock_guard<std::mutex> lock(shard->mu);
+    auto it = shard->kvs.find(full_key);
+    if (it == shard->kvs.end()) {
+      return Status::NotFound("Key not found");
+    }
+    v = it->second;
+  }
+  value->assign(*v);
+  return Status::OK();
+}
+
+Status MemStore::Delete(const std::string& table, const std::string& key) {
+  std::string full_key;
+  Shard* shard = FindShard(table, key, &full_key);
+  // Large values are freed out of the lock
+  std::shared_ptr<const std::string> v;
+  {
+    std::lock_guard<std::mutex> lock(shard->mu);
+    auto it = shard->kvs.find(full_key);
+    if (it == shard->kvs.end()) {
+      return Status::OK();
+    }
+    v.swap(it->second);
+    shard->kvs.erase(it);
+  }
+  return Status::OK();
+}
+
+MemBackend::MemBackend(MemStore* store)
+      : store_(store),
+        rand_state_(slash::NowMicros() ^ reinterpret_cast<uintptr_t>(this)) {
+}
+
+void MemBackend::Delay() {
+  const MemStoreOptions& options = store_->options();
+  uint64_t delay = options.latency_us;
+  if (options.latency_jitter_us > 0) {
+    // xorshift64
+    rand_state_ ^= rand_state_ << 13;
+    rand_state_ ^= rand_state_ >> 7;
+    rand_state_ ^= rand_state_ << 17;
+    delay += rand_state_ % (options.latency_jitter_us + 1);
+  }
+  if (delay > 0) {
+    slash::SleepForMicroseconds(delay);
+  }
+}
+
+Status MemBackend::ListTable(std::vector<std::string>* tables) {
+  return store_->ListTable(tables);
+}
+
+Status MemBackend::CreateTable(const std::string& table, int partition_num) {
+  return store_->CreateTable(table);
+}
+
+Status MemBackend::Set(const std::string& table, const std::string& key,
+                       const std::string& value) {
+  Delay();
+  return store_->Set(table, key, value);
+}
+
+Status MemBackend::Get(const std::string& table, const std::string& key,
+                       std::string* value) {
+  Delay();
+  return store_->Get(table, key, value);
+}
+
+Status MemBackend::Delete(const std::string& table, const std::string& key) {
+  Delay();
+  return store_->Delete(table, key);
+}
+
+Status MemBackend::Mget(const std::string& table,
+                        const std::vector<std::string>& keys,
+                        std::map<std::string, std::string>* values) {
+  // One round trip for all keys
+  Delay();
+  std::string value;
+  for (auto& key : keys) {
+    Status s = store_->Get(table, key, &value);
+    if (s.ok()) {
+      (*values)[key] = value;
+    } else if (!s.IsNotFound()) {
+      return s;
+    }
+  }
+  return Status::OK();
+}
+
+}  // namespace libzgw
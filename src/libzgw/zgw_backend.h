@@ -0,0 +1,169 @@
+#ifndef ZGW_BACKEND_H
+#define ZGW_BACKEND_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <mutex>
+#include <memory>
+#include <unordered_map>
+
+#include "slash/include/slash_status.h"
+#include "libzp/include/zp_cluster.h"
+
+namespace libzgw {
+
+using slash::Status;
+
+// Key value tables ZgwStore keeps everything in. One instance is used
+// by one thread at a time
+class ZgwBackend {
+ public:
+  virtual ~ZgwBackend() {}
+
+  virtual Status ListTable(std::vector<std::string>* tables) = 0;
+  virtual Status CreateTable(const std::string& table, int partition_num) = 0;
+  // Block until tables just created can take requests
+  virtual void WaitForNewTables() {}
+
+  virtual Status Set(const std::string& table, const std::string& key,
+                     const std::string& value) = 0;
+  virtual Status Get(const std::string& table, const std::string& key,
+                     std::string* value) = 0;
+  virtual Status Delete(const std::string& table, const std::string& key) = 0;
+  // Keys not found are left out of values
+  virtual Status Mget(const std::string& table,
+                      const std::vector<std::string>& keys,
+                      std::map<std::string, std::string>* values) = 0;
+};
+
+// zeppelin cluster
+class ZpBackend : public ZgwBackend {
+ public:
+  explicit ZpBackend(const libzp::Options& options)
+      : zp_(new libzp::Cluster(options)) {
+  }
+  virtual ~ZpBackend() {
+    delete zp_;
+  }
+
+  virtual Status ListTable(std::vector<std::string>* tables) override {
+    return zp_->ListTable(tables);
+  }
+  virtual Status CreateTable(const std::string& table,
+                             int partition_num) override {
+    return zp_->CreateTable(table, partition_num);
+  }
+  virtual void WaitForNewTables() override;
+
+  virtual Status Set(const std::string& table, const std::string& key,
+                     const std::string& value) override {
+    return zp_->Set(table, key, value);
+  }
+  virtual Status Get(const std::string& table, const std::string& key,
+                     std::string* value) override {
+    return zp_->Get(table, key, value);
+  }
+  virtual Status Delete(const std::string& table,
+                        const std::string& key) override {
+    return zp_->Delete(table, key);
+  }
+  virtual Status Mget(const std::string& table,
+                      const std::vector<std::string>& keys,
+                      std::map<std::string, std::string>* values) override {
+    return zp_->Mget(table, keys, values);
+  }
+
+ private:
+  libzp::Cluster* zp_;
+
+  // No copying allowed
+  ZpBackend(const ZpBackend&);
+  void operator=(const ZpBackend&);
+};
+
+struct MemStoreOptions {
+  // Delay added to every call, as a stand in for the network
+  uint64_t latency_us;
+  // plus a uniformly random part up to this
+  uint64_t latency_jitter_us;
+
+  MemStoreOptions()
+      : latency_us(0),
+        latency_jitter_us(0) {
+  }
+};
+
+static const size_t kMemStoreShards = 64;
+
+// Tables of the in memory backend, shared by all MemBackends of the
+// process so every worker sees the same data. Nothing is persisted, and
+// keys are not checked against the created tables
+class MemStore {
+ public:
+  explicit MemStore(const MemStoreOptions& options)
+      : options_(options) {
+  }
+
+  const MemStoreOptions& options() const {
+    return options_;
+  }
+
+  Status ListTable(std::vector<std::string>* tables);
+  Status CreateTable(const std::string& table);
+  Status Set(const std::string& table, const std::string& key,
+             const std::string& value);
+  Status Get(const std::string& table, const std::string& key,
+             std::string* value);
+  Status Delete(const std::string& table, const std::string& key);
+
+ private:
+  struct Shard {
+    std::mutex mu;
+    // table + '\0' + key : value, copied out of the lock
+    std::unordered_map<std::string, std::shared_ptr<const std::string>> kvs;
+  };
+
+  MemStoreOptions options_;
+  std::mutex tables_mu_;
+  std::set<std::string> tables_;
+  Shard shards_[kMemStoreShards];
+
+  Shard* FindShard(const std::string& table, const std::string& key,
+                   std::string* full_key);
+
+  // No copying allowed
+  MemStore(const MemStore&);
+  void operator=(const MemStore&);
+};
+
+// In memory stand in for zeppelin, for load testing the gateway alone
+class MemBackend : public ZgwBackend {
+ public:
+  explicit MemBackend(MemStore* store);
+
+  virtual Status ListTable(std::vector<std::string>* tables) override;
+  virtual Status CreateTable(const std::string& table,
+                             int partition_num) override;
+
+  virtual Status Set(const std::string& table, const std::string& key,
+                     const std::string& value) override;
+  virtual Status Get(const std::string& table, const std::string& key,
+                     std::string* value) override;
+  virtual Status Delete(const std::string& table,
+                        const std::string& key) override;
+  virtual Status Mget(const std::string& table,
+                      const std::vector<std::string>& keys,
+                      std::map<std::string, std::string>* values) override;
+
+ private:
+  MemStore* store_;
+  uint64_t rand_state_;
+
+  void Delay();
+};
+
+}  // namespace libzgw
+
+#endif  // ZGW_BACKEND_H
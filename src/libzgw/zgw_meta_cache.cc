@@ -0,0 +1,118 @@
+#include "src/libzgw/zgw_meta_cache.h"
+
+#include <functional>
+#include <iterator>
+
+#include "slash/include/env.h"
+#include "src/libzgw/zgw_object.h"
+
+namespace libzgw {
+
+MetaCache::MetaCache(uint64_t capacity_bytes, uint64_t ttl_us)
+      : shard_capacity_(capacity_bytes / kMetaCacheShards),
+        ttl_us_(ttl_us) {
+  for (auto& shard : shards_) {
+    shard.bytes = 0;
+    shard.epoch = 0;
+  }
+}
+
+MetaCache::Shard* MetaCache::FindShard(const std::string& key) {
+  return &shards_[std::hash<std::string>()(key) % kMetaCacheShards];
+}
+
+void MetaCache::Remove(Shard* shard, std::list<Entry>::iterator it) {
+  shard->bytes -= it->charge;
+  shard->index.erase(it->key);
+  shard->lru.erase(it);
+}
+
+uint64_t MetaCache::Ticket(const std::string& key) {
+  Shard* shard = FindShard(key);
+  std::lock_guard<std::mutex> lock(shard->mu);
+  return shard->epoch;
+}
+
+bool MetaCache::Lookup(const std::string& key, ZgwObject* object) {
+  Shard* shard = FindShard(key);
+  std::shared_ptr<const ZgwObject> o;
+  {
+    std::lock_guard<std::mutex> lock(shard->mu);
+    auto it = shard->index.find(key);
+    if (it == shard->index.end()) {
+      shard->stats.misses++;
+      return false;
+    }
+    if (it->second->expire_us <= slash::NowMicros()) {
+      Remove(shard, it->second);
+      shard->stats.misses++;
+      shard->stats.expired++;
+      return false;
+    }
+    shard->stats.hits++;
+    shard->lru.splice(shard->lru.begin(), shard->lru, it->second);
+    o = it->second->object;
+  }
+  *object = *o;
+  return true;
+}
+
+void MetaCache::Insert(const std::string& key, uint64_t ticket,
+                       const ZgwObject& object, uint64_t charge) {
+  Entry entry;
+  entry.key = key;
+  entry.charge = key.size() + charge + 128;
+  entry.expire_us = slash::NowMicros() + ttl_us_;
+  if (entry.charge > shard_capacity_ / 4) {
+    return;
+  }
+  entry.object = std::make_shared<const ZgwObject>(object);
+
+  Shard* shard = FindShard(key);
+  std::lock_guard<std::mutex> lock(shard->mu);
+  if (ticket != shard->epoch) {
+    // A key of this shard was written since the read began, it may
+    // have been this one
+    shard->stats.stale_inserts++;
+    return;
+  }
+  auto it = shard->index.find(key);
+  if (it != shard->index.end()) {
+    Remove(shard, it->second);
+  }
+  while (shard->bytes + entry.charge > shard_capacity_) {
+    Remove(shard, std::prev(shard->lru.end()));
+    shard->stats.evictions++;
+  }
+  shard->bytes += entry.charge;
+  shard->lru.push_front(std::move(entry));
+  shard->index[key] = shard->lru.begin();
+}
+
+void MetaCache::Invalidate(const std::string& key) {
+  Shard* shard = FindShard(key);
+  std::lock_guard<std::mutex> lock(shard->mu);
+  shard->epoch++;
+  shard->stats.invalidations++;
+  auto it = shard->index.find(key);
+  if (it != shard->index.end()) {
+    Remove(shard, it->second);
+  }
+}
+
+void MetaCache::GetStats(MetaCacheStats* stats) {
+  *stats = MetaCacheStats();
+  for (auto& shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.mu);
+    stats->hits += shard.stats.hits;
+    stats->misses += shard.stats.misses;
+    stats->expired += shard.stats.expired;
+    stats->invalidations += shard.stats.invalidations;
+    stats->stale_inserts += shard.stats.stale_inserts;
+    stats->evictions += shard.stats.evictions;
+    stats->resident += shard.index.size();
+    stats->resident_bytes += shard.bytes;
+  }
+}
+
+}  // namespace libzgw
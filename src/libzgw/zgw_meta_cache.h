@@ -0,0 +1,88 @@
+#ifndef ZGW_META_CACHE_H
+#define ZGW_META_CACHE_H
+
+#include <stdint.h>
+#include <string>
+#include <list>
+#include <mutex>
+#include <memory>
+#include <unordered_map>
+
+namespace libzgw {
+
+class ZgwObject;
+
+struct MetaCacheStats {
+  uint64_t hits;
+  uint64_t misses;
+  // Misses on entries older than the ttl
+  uint64_t expired;
+  uint64_t invalidations;
+  // Reads dropped because their key may have been written meanwhile
+  uint64_t stale_inserts;
+  uint64_t evictions;
+  uint64_t resident;
+  uint64_t resident_bytes;
+
+  MetaCacheStats()
+      : hits(0), misses(0), expired(0), invalidations(0), stale_inserts(0),
+        evictions(0), resident(0), resident_bytes(0) {
+  }
+};
+
+static const size_t kMetaCacheShards = 16;
+
+// Object metas recently read, by ZgwObject::MetaKey, shared by the
+// stores of all workers. Writes of this process invalidate their key;
+// writes of other gateways are only seen once the entry is ttl old
+class MetaCache {
+ public:
+  MetaCache(uint64_t capacity_bytes, uint64_t ttl_us);
+
+  // Take before reading key from zeppelin and pass to Insert, which then
+  // drops the read if key was invalidated in between
+  uint64_t Ticket(const std::string& key);
+  bool Lookup(const std::string& key, ZgwObject* object);
+  // charge is about the size of the meta value object was parsed from
+  void Insert(const std::string& key, uint64_t ticket,
+              const ZgwObject& object, uint64_t charge);
+  // Call once key was written or deleted
+  void Invalidate(const std::string& key);
+
+  void GetStats(MetaCacheStats* stats);
+
+ private:
+  struct Entry {
+    std::string key;
+    uint64_t charge;
+    uint64_t expire_us;
+    std::shared_ptr<const ZgwObject> object;
+  };
+
+  struct Shard {
+    std::mutex mu;
+    // Most recently used first
+    std::list<Entry> lru;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    uint64_t bytes;
+    // Bumped by every Invalidate of a key in this shard
+    uint64_t epoch;
+    MetaCacheStats stats;
+  };
+
+  uint64_t shard_capacity_;
+  uint64_t ttl_us_;
+  Shard shards_[kMetaCacheShards];
+
+  Shard* FindShard(const std::string& key);
+  // Called with shard->mu held
+  void Remove(Shard* shard, std::list<Entry>::iterator it);
+
+  // No copying allowed
+  MetaCache(const MetaCache&);
+  void operator=(const MetaCache&);
+};
+
+}  // namespace libzgw
+
+#endif  // ZGW_META_CACHE_H
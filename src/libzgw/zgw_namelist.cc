@@ -1,8 +1,10 @@
 #include "src/libzgw/zgw_namelist.h"
 
 #include <iostream>
+#include <iterator>
 
 #include "slash/include/slash_coding.h"
+#include "slash/include/env.h"
 
 using slash::Slice;
 
@@ -11,18 +13,46 @@ namespace libzgw {
 static const std::string kBucketsListPre = "__Buckets_list_";
 static const std::string kObjectsListPre = "__Objects_list_";
 
-std::string NameList::MetaValue() const {
-  std::lock_guard<std::mutex> lock(list_lock);
+static const uint32_t kPagedListMagic = 0xFFFFFFFF;
+static const uint32_t kPagedListVersion = 1;
+static const size_t kPageMaxNames = 1024;
+static const std::string kPageKeySep = "__Page_";
+// Rough per name cost of a std::set node plus std::string header
+static const uint64_t kNameOverhead = 64;
+
+static uint64_t NameCharge(const std::string& name) {
+  return name.size() + kNameOverhead;
+}
+
+NameList::NameList(std::string key)
+    : dirty_(false),
+      dir_dirty_(true),
+      dirty_since_us_(0),
+      pending_mutations_(0),
+      ref_(0),
+      meta_key_(std::move(key)),
+      next_page_id_(1),
+      mem_usage_(sizeof(Page)) {
+  // A list not yet on zeppelin is one empty page, its directory is
+  // written along with the first flush
+  pages_.push_back(Page(0, ""));
+  pages_.back().loaded = true;
+}
+
+std::string NameList::PageKey(uint64_t page_id) const {
+  return meta_key_ + kPageKeySep + std::to_string(page_id);
+}
+
+static std::string EncodePage(const std::set<std::string>& names) {
   std::string value;
-  slash::PutFixed32(&value, name_list.size());
-  for (const auto& name : name_list) {
+  slash::PutFixed32(&value, names.size());
+  for (const auto& name : names) {
     slash::PutLengthPrefixedString(&value, name);
   }
   return value;
 }
 
-Status NameList::ParseMetaValue(std::string* value) {
-  std::lock_guard<std::mutex> lock(list_lock);
+static Status DecodePage(std::string* value, std::set<std::string>* names) {
   uint32_t count;
   slash::GetFixed32(value, &count);
   Slice svalue(*value);
@@ -32,52 +62,419 @@ Status NameList::ParseMetaValue(std::string* value) {
     if (!res) {
       return Status::Corruption("Parse name failed");
     }
-    name_list.insert(name.ToString());
+    names->insert(name.ToString());
+  }
+  return Status::OK();
+}
+
+std::string NameList::EncodeDirectory() const {
+  std::string value;
+  slash::PutFixed32(&value, kPagedListMagic);
+  slash::PutFixed32(&value, kPagedListVersion);
+  slash::PutFixed64(&value, next_page_id_);
+  slash::PutFixed32(&value, pages_.size());
+  for (const auto& page : pages_) {
+    slash::PutFixed64(&value, page.id);
+    slash::PutLengthPrefixedString(&value, page.first);
+  }
+  return value;
+}
+
+std::string NameList::MetaValue() const {
+  std::lock_guard<std::mutex> lock(list_lock);
+  return EncodeDirectory();
+}
+
+Status NameList::ParseMetaValue(std::string* value) {
+  std::lock_guard<std::mutex> lock(list_lock);
+  if (value->size() < sizeof(uint32_t) ||
+      slash::DecodeFixed32(value->data()) != kPagedListMagic) {
+    return ParseLegacyValue(value);
+  }
+
+  uint32_t tmp, count;
+  slash::GetFixed32(value, &tmp); // magic
+  slash::GetFixed32(value, &tmp); // version
+  slash::GetFixed64(value, &next_page_id_);
+  slash::GetFixed32(value, &count);
+  std::vector<Page> pages;
+  uint64_t id;
+  std::string first;
+  for (uint32_t i = 0; i < count; i++) {
+    slash::GetFixed64(value, &id);
+    if (!slash::GetLengthPrefixedString(value, &first)) {
+      return Status::Corruption("Parse name list page failed");
+    }
+    pages.push_back(Page(id, first));
+  }
+  if (pages.empty()) {
+    return Status::Corruption("Name list has no page");
+  }
+  pages_.swap(pages);
+  dir_dirty_ = false;
+  mem_usage_ = pages_.size() * sizeof(Page);
+  return Status::OK();
+}
+
+// Whole list in one value, written before names were paged; cut it
+// into pages and rewrite them on the next flush
+Status NameList::ParseLegacyValue(std::string* value) {
+  std::set<std::string> names;
+  Status s = DecodePage(value, &names);
+  if (!s.ok()) {
+    return s;
+  }
+
+  pages_.clear();
+  mem_usage_ = 0;
+  auto it = names.begin();
+  do {
+    pages_.push_back(Page(next_page_id_++, pages_.empty() ? "" : *it));
+    Page& page = pages_.back();
+    page.loaded = true;
+    page.dirty = true;
+    mem_usage_ += sizeof(Page);
+    for (size_t n = 0; n < kPageMaxNames / 2 && it != names.end(); ++n) {
+      mem_usage_ += NameCharge(*it);
+      page.names.insert(*it++);
+    }
+  } while (it != names.end());
+  dir_dirty_ = true;
+  MarkDirty();
+  return Status::OK();
+}
+
+void NameList::MarkDirty() {
+  if (!dirty_) {
+    dirty_since_us_ = slash::NowMicros();
+  }
+  dirty_ = true;
+  ++pending_mutations_;
+}
+
+void NameList::SetDirty(bool value) {
+  std::lock_guard<std::mutex> lock(list_lock);
+  if (value) {
+    MarkDirty();
+  } else {
+    dirty_ = false;
+    pending_mutations_ = 0;
+  }
+  dir_dirty_ = value;
+  for (auto& page : pages_) {
+    page.dirty = value && page.loaded;
+  }
+}
+
+void NameList::TakeDirty(std::vector<std::pair<std::string, std::string>>* updates,
+                         std::vector<std::string>* deletes) {
+  std::lock_guard<std::mutex> lock(list_lock);
+  for (auto& page : pages_) {
+    if (page.dirty) {
+      updates->push_back(std::make_pair(PageKey(page.id), EncodePage(page.names)));
+      page.dirty = false;
+    }
+  }
+  // Directory goes after the pages it points to
+  if (dir_dirty_) {
+    updates->push_back(std::make_pair(meta_key_, EncodeDirectory()));
+    dir_dirty_ = false;
   }
+  deletes->insert(deletes->end(), dropped_keys_.begin(), dropped_keys_.end());
+  dropped_keys_.clear();
+  dirty_ = false;
+  pending_mutations_ = 0;
+}
 
+void NameList::SaveFailed(std::vector<std::string>* deletes) {
+  SetDirty(true);
+  std::lock_guard<std::mutex> lock(list_lock);
+  dropped_keys_.insert(dropped_keys_.end(), deletes->begin(), deletes->end());
+  deletes->clear();
+}
+
+void NameList::DeleteFailed(std::vector<std::string>* keys) {
+  std::lock_guard<std::mutex> lock(list_lock);
+  MarkDirty();
+  dropped_keys_.insert(dropped_keys_.end(), keys->begin(), keys->end());
+  keys->clear();
+}
+
+size_t NameList::FindPage(const std::string& name) const {
+  size_t lo = 0, hi = pages_.size();
+  // Last page whose first name is not greater than name
+  while (hi - lo > 1) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (pages_[mid].first <= name) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+Status NameList::LoadPage(ZgwStore* store, Page* page) {
+  if (page->loaded) {
+    return Status::OK();
+  }
+  std::string value;
+  Status s = store->GetNameListPage(PageKey(page->id), &value);
+  if (s.IsNotFound()) {
+    page->loaded = true;
+    return Status::OK();
+  } else if (!s.ok()) {
+    return s;
+  }
+  s = DecodePage(&value, &page->names);
+  if (!s.ok()) {
+    page->names.clear();
+    return s;
+  }
+  for (const auto& name : page->names) {
+    mem_usage_ += NameCharge(name);
+  }
+  page->loaded = true;
   return Status::OK();
 }
 
+void NameList::SplitPage(size_t index) {
+  Page& page = pages_[index];
+  // The lower half moves to a new page as well, the old one is deleted
+  // only after the directory pointing to both halves is written, so a
+  // failed save in between loses no name
+  dropped_keys_.push_back(PageKey(page.id));
+  page.id = next_page_id_++;
+  auto mid = page.names.begin();
+  std::advance(mid, page.names.size() / 2);
+  Page upper(next_page_id_++, *mid);
+  upper.loaded = true;
+  upper.dirty = true;
+  upper.names.insert(mid, page.names.end());
+  page.names.erase(mid, page.names.end());
+  page.dirty = true;
+  pages_.insert(pages_.begin() + index + 1, std::move(upper));
+  mem_usage_ += sizeof(Page);
+  dir_dirty_ = true;
+}
+
+void NameList::DropPage(size_t index) {
+  dropped_keys_.push_back(PageKey(pages_[index].id));
+  pages_.erase(pages_.begin() + index);
+  mem_usage_ -= sizeof(Page);
+  // The first page always covers from the smallest name
+  pages_.front().first.clear();
+  dir_dirty_ = true;
+}
+
+ListMap::ListMap(KEY_TYPE key_type, const ListMapOptions& options)
+      : key_type_(key_type),
+        options_(options),
+        shard_cache_bytes_(options.cache_bytes / kListMapShards),
+        flush_wanted_(false) {
+}
+
+ListMap::~ListMap() {
+  for (auto& shard : shards_) {
+    for (auto& kv : shard.map_list) {
+      delete kv.second.list;
+    }
+  }
+}
+
+ListMap::Shard* ListMap::GetShard(const std::string& key) {
+  return &shards_[std::hash<std::string>()(key) % kListMapShards];
+}
+
 Status ListMap::Ref(ZgwStore *store, const std::string key, NameList **names) {
-  std::lock_guard<std::mutex> lock(ref_lock_);
-  Status s;
-  NameList *l_names;
-  if (map_list_.find(key) == map_list_.end()) {
-    s = InitNameList(key, store, &l_names);
-    if (!s.ok()) {
+  Shard* shard = GetShard(key);
+  std::unique_lock<std::mutex> lock(shard->ref_lock);
+  auto it = shard->map_list.find(key);
+  while (it != shard->map_list.end()) {
+    Entry& entry = it->second;
+    if (entry.list != NULL && entry.in_lru && entry.pins == 0 &&
+        !entry.list->dirty() && options_.revalidate_us > 0 &&
+        slash::NowMicros() - entry.loaded_us >= options_.revalidate_us) {
+      // Other gateways may have changed it since, nobody holds it
+      shard->lru.erase(entry.lru_pos);
+      shard->usage -= entry.charge;
+      delete entry.list;
+      shard->map_list.erase(it);
+      break;
+    }
+    if (entry.list != NULL) {
+      ++shard->hits;
+      if (entry.in_lru) {
+        shard->lru.erase(entry.lru_pos);
+        entry.in_lru = false;
+      }
+      entry.list->Ref();
+      *names = entry.list;
+      return Status::OK();
+    }
+    // Another thread is reading it from zeppelin, share its result
+    std::shared_ptr<Loading> loading = entry.loading;
+    shard->load_cond.wait(lock, [&loading] { return loading->done; });
+    if (!loading->status.ok()) {
       *names = NULL;
-      return s;
+      return loading->status;
     }
+    // Look up again, it may have been evicted meanwhile
+    it = shard->map_list.find(key);
+  }
+
+  ++shard->misses;
+  std::shared_ptr<Loading> loading = std::make_shared<Loading>();
+  Entry& placeholder = shard->map_list[key];
+  placeholder.loading = loading;
+  lock.unlock();
+
+  NameList *nl = NULL;
+  Status s = InitNameList(key, store, &nl);
+
+  lock.lock();
+  loading->done = true;
+  loading->status = s;
+  shard->load_cond.notify_all();
+  if (!s.ok()) {
+    shard->map_list.erase(key);
+    *names = NULL;
+    return s;
   }
-  NameList *nl = map_list_[key];
+  // Entries being loaded are never erased by others
+  Entry& entry = shard->map_list[key];
+  entry.list = nl;
+  entry.loading.reset();
+  entry.loaded_us = slash::NowMicros();
+  entry.charge = nl->MemoryUsage();
+  shard->usage += entry.charge;
   nl->Ref();
   *names = nl;
-
   return Status::OK();
 }
 
 Status ListMap::Unref(ZgwStore *store, const std::string &key) {
-  Status s = Status::OK();
-  std::lock_guard<std::mutex> lock(ref_lock_);
-  if (map_list_.find(key) == map_list_.end()) {
-    // Ignore
-    return s;
+  Shard* shard = GetShard(key);
+  NameList *nl;
+  {
+    std::lock_guard<std::mutex> lock(shard->ref_lock);
+    auto it = shard->map_list.find(key);
+    if (it == shard->map_list.end() || it->second.list == NULL) {
+      // Ignore
+      return Status::OK();
+    }
+    Entry& entry = it->second;
+    nl = entry.list;
+    if (entry.in_lru) {
+      // Not referenced, an unpaired Unref
+      return Status::OK();
+    }
+    if (nl->Unref()) {
+      // Keep it resident for the next request on the same key
+      shard->usage = shard->usage - entry.charge + nl->MemoryUsage();
+      entry.charge = nl->MemoryUsage();
+      shard->lru.push_front(key);
+      entry.lru_pos = shard->lru.begin();
+      entry.in_lru = true;
+    }
+    if (!nl->dirty() || !options_.sync_flush) {
+      if (nl->pending_mutations() >= options_.flush_mutations) {
+        flush_wanted_ = true;
+      }
+      Evict(shard);
+      return Status::OK();
+    }
+    // Save before the caller answers its request
+    ++entry.pins;
   }
-  NameList *nl = map_list_[key];
-  bool should_flush = nl->Unref();
 
-  if (should_flush) {
-    if (nl->dirty()) {
-      s = store->SaveNameList(nl);
-      if (!s.ok()) {
-        return s;
+  Status s = store->SaveNameList(nl);
+  std::lock_guard<std::mutex> lock(shard->ref_lock);
+  --shard->map_list[key].pins;
+  Evict(shard);
+  return s;
+}
+
+Status ListMap::Flush(ZgwStore* store, bool force) {
+  Status s, ret;
+  flush_wanted_ = false;
+  for (auto& shard : shards_) {
+    s = FlushShard(store, &shard, force);
+    if (!s.ok() && ret.ok()) {
+      ret = s;
+    }
+  }
+  return ret;
+}
+
+Status ListMap::FlushShard(ZgwStore* store, Shard* shard, bool force) {
+  std::vector<std::string> keys;
+  std::vector<NameList*> lists;
+  uint64_t now = slash::NowMicros();
+  {
+    std::lock_guard<std::mutex> lock(shard->ref_lock);
+    for (auto& kv : shard->map_list) {
+      NameList* nl = kv.second.list;
+      if (nl == NULL || !nl->dirty()) {
+        continue;
+      }
+      if (force ||
+          nl->pending_mutations() >= options_.flush_mutations ||
+          now - nl->dirty_since() >= options_.flush_interval_us) {
+        ++kv.second.pins;
+        keys.push_back(kv.first);
+        lists.push_back(nl);
       }
-      nl->SetDirty(false);
     }
+  }
+
+  // Mutations keep going on while the snapshots taken are written
+  Status s, ret;
+  for (auto nl : lists) {
+    s = store->SaveNameList(nl);
+    if (!s.ok() && ret.ok()) {
+      ret = s;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(shard->ref_lock);
+  for (auto& key : keys) {
+    --shard->map_list[key].pins;
+  }
+  shard->flushes += lists.size();
+  Evict(shard);
+  return ret;
+}
+
+void ListMap::Evict(Shard* shard) {
+  auto pos = shard->lru.end();
+  while (shard->usage > shard_cache_bytes_ && pos != shard->lru.begin()) {
+    --pos;
+    auto it = shard->map_list.find(*pos);
+    NameList* nl = it->second.list;
+    if (nl->dirty() || it->second.pins > 0) {
+      // Never drop unsaved names, the flusher will clean it
+      continue;
+    }
+    shard->usage -= it->second.charge;
     delete nl;
-    map_list_.erase(key);
+    shard->map_list.erase(it);
+    pos = shard->lru.erase(pos);
+    ++shard->evictions;
+  }
+}
+
+void ListMap::GetStats(ListMapStats* stats) {
+  *stats = ListMapStats();
+  for (auto& shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.ref_lock);
+    stats->hits += shard.hits;
+    stats->misses += shard.misses;
+    stats->evictions += shard.evictions;
+    stats->flushes += shard.flushes;
+    stats->resident += shard.map_list.size();
+    stats->resident_bytes += shard.usage;
   }
-  return s;
 }
 
 Status ListMap::InitNameList(const std::string &key, ZgwStore *store,
@@ -100,32 +497,124 @@ Status ListMap::InitNameList(const std::string &key, ZgwStore *store,
     delete new_list;
     return s;
   }
+  *names = new_list;
 
-  map_list_.insert(std::make_pair(key, new_list));
+  return Status::OK();
+}
 
+Status NameList::Insert(ZgwStore* store, const std::string &value) {
+  std::lock_guard<std::mutex> lock(list_lock);
+  size_t index = FindPage(value);
+  Status s = LoadPage(store, &pages_[index]);
+  if (!s.ok()) {
+    return s;
+  }
+  Page& page = pages_[index];
+  if (page.names.insert(value).second) {
+    mem_usage_ += NameCharge(value);
+    page.dirty = true;
+    MarkDirty();
+    if (page.names.size() > kPageMaxNames) {
+      SplitPage(index);
+    }
+  }
   return Status::OK();
 }
 
-void NameList::Insert(const std::string &value) {
+Status NameList::Delete(ZgwStore* store, const std::string &value) {
   std::lock_guard<std::mutex> lock(list_lock);
-  name_list.insert(value);
-  dirty_ = true;
+  size_t index = FindPage(value);
+  Status s = LoadPage(store, &pages_[index]);
+  if (!s.ok()) {
+    return s;
+  }
+  Page& page = pages_[index];
+  if (page.names.erase(value) > 0) {
+    mem_usage_ -= NameCharge(value);
+    page.dirty = true;
+    MarkDirty();
+    if (page.names.empty() && pages_.size() > 1) {
+      DropPage(index);
+    }
+  }
+  return Status::OK();
 }
 
-void NameList::Delete(const std::string &value) {
+bool NameList::IsExist(ZgwStore* store, const std::string &value) {
   std::lock_guard<std::mutex> lock(list_lock);
-  name_list.erase(value);
-  dirty_ = true;
+  Page& page = pages_[FindPage(value)];
+  if (!LoadPage(store, &page).ok()) {
+    return false;
+  }
+  return (page.names.find(value) != page.names.end());
+}
+
+bool NameList::IsEmpty(ZgwStore* store) {
+  std::lock_guard<std::mutex> lock(list_lock);
+  // Empty pages are dropped unless it is the only one
+  if (pages_.size() > 1) {
+    return false;
+  }
+  if (!LoadPage(store, &pages_.front()).ok()) {
+    return false;
+  }
+  return pages_.front().names.empty();
+}
+
+Status NameList::Size(ZgwStore* store, uint64_t* size) {
+  std::lock_guard<std::mutex> lock(list_lock);
+  *size = 0;
+  for (auto& page : pages_) {
+    Status s = LoadPage(store, &page);
+    if (!s.ok()) {
+      return s;
+    }
+    *size += page.names.size();
+  }
+  return Status::OK();
 }
 
-bool NameList::IsExist(const std::string &value) {
+Status NameList::LowerBound(ZgwStore* store, const std::string& target,
+                            std::string* name) {
   std::lock_guard<std::mutex> lock(list_lock);
-  return (name_list.find(value) != name_list.end());
+  for (size_t i = FindPage(target); i < pages_.size(); i++) {
+    Status s = LoadPage(store, &pages_[i]);
+    if (!s.ok()) {
+      return s;
+    }
+    auto it = pages_[i].names.lower_bound(target);
+    if (it != pages_[i].names.end()) {
+      name->assign(*it);
+      return Status::OK();
+    }
+  }
+  return Status::NotFound("No more names");
+}
+
+Status NameList::ListAll(ZgwStore* store, std::set<std::string>* names) {
+  std::lock_guard<std::mutex> lock(list_lock);
+  for (auto& page : pages_) {
+    Status s = LoadPage(store, &page);
+    if (!s.ok()) {
+      return s;
+    }
+    names->insert(page.names.begin(), page.names.end());
+  }
+  return Status::OK();
 }
 
-bool NameList::IsEmpty() {
+void NameList::Clear() {
   std::lock_guard<std::mutex> lock(list_lock);
-  return name_list.empty();
+  for (auto& page : pages_) {
+    dropped_keys_.push_back(PageKey(page.id));
+  }
+  pages_.clear();
+  pages_.push_back(Page(next_page_id_++, ""));
+  pages_.back().loaded = true;
+  pages_.back().dirty = true;
+  mem_usage_ = sizeof(Page);
+  dir_dirty_ = true;
+  MarkDirty();
 }
 
 }  // namespace libzgw
@@ -5,7 +5,12 @@
 #include <string>
 #include <set>
 #include <map>
+#include <list>
+#include <vector>
 #include <mutex>
+#include <atomic>
+#include <memory>
+#include <condition_variable>
 
 #include "slash/include/slash_status.h"
 #include "src/libzgw/zgw_store.h"
@@ -16,78 +21,249 @@ namespace libzgw {
 
 class ZgwStore;
 
+// Ordered name index of one user's buckets or one bucket's objects.
+//
+// Names are range partitioned into pages. The meta key holds only the
+// page directory, every page is persisted under its own key and loaded
+// from zeppelin the first time it is touched, so a mutation rewrites a
+// single page and a lookup reads at most one.
 class NameList {
  public:
-  explicit NameList(std::string key)
-      : dirty_(false),
-        ref_(0),
-        meta_key_(std::move(key)) {
-  }
+  explicit NameList(std::string key);
 
   bool dirty() const {
-    return dirty_;
+    return dirty_.load();
+  }
+
+  // When the list went from clean to dirty
+  uint64_t dirty_since() const {
+    return dirty_since_us_.load();
   }
 
-  void SetDirty(bool value) {
-    dirty_ = value;
+  // Mutations since the last save
+  uint64_t pending_mutations() const {
+    return pending_mutations_.load();
   }
 
+  // true marks every loaded page and the directory to be rewritten
+  void SetDirty(bool value);
+
   void Ref() {
     ++ref_;
     std::cerr << meta_key_ + " after Ref: " << ref_ << std::endl;
   }
 
+  // true once the last reference is dropped, false for an Unref
+  // without a reference
   bool Unref() {
-    --ref_;
-    std::cerr << meta_key_ + " after Unref: " << ref_ << std::endl;
     if (ref_ <= 0) {
-      ref_ = 0; // Avoid multi unref
-      return true;
+      return false;
     }
-    return false;
+    --ref_;
+    std::cerr << meta_key_ + " after Unref: " << ref_ << std::endl;
+    return ref_ == 0;
   }
 
-  void Insert(const std::string& value);
-  void Delete(const std::string& value);
-  bool IsExist(const std::string& value);
-  bool IsEmpty();
+  // store is used to load the page a name falls in if not loaded yet
+  Status Insert(ZgwStore* store, const std::string& value);
+  Status Delete(ZgwStore* store, const std::string& value);
+  // Page load failure is reported as not exist
+  bool IsExist(ZgwStore* store, const std::string& value);
+  bool IsEmpty(ZgwStore* store);
+  Status Size(ZgwStore* store, uint64_t* size);
+  // Smallest name not less than target, NotFound if there is none
+  Status LowerBound(ZgwStore* store, const std::string& target,
+                    std::string* name);
+  Status ListAll(ZgwStore* store, std::set<std::string>* names);
+  void Clear();
+
+  // Approximate bytes held by the loaded pages
+  uint64_t MemoryUsage() const {
+    return mem_usage_.load();
+  }
 
   std::string MetaKey() const {
     return meta_key_;
   }
+  std::string PageKey(uint64_t page_id) const;
+  // Page directory
   std::string MetaValue() const;
   Status ParseMetaValue(std::string* meta_value);
+  // Encode dirty pages, then the directory if changed, and mark them
+  // clean; deletes get the keys of dropped pages, to be deleted once the
+  // updates are written
+  void TakeDirty(std::vector<std::pair<std::string, std::string>>* updates,
+                 std::vector<std::string>* deletes);
+  // A save of what TakeDirty took failed: mark every loaded page and the
+  // directory dirty, and take back the page keys not yet deleted
+  void SaveFailed(std::vector<std::string>* deletes);
+  // The updates were written but some page keys were not deleted: take
+  // back only those, to be deleted by the next save
+  void DeleteFailed(std::vector<std::string>* keys);
 
   mutable std::mutex list_lock;
-  std::set<std::string> name_list;
+  // Held by SaveNameList so snapshots reach zeppelin in order
+  std::mutex save_lock;
 
  private:
-  bool dirty_;
+  struct Page {
+    uint64_t id;
+    std::string first; // Lower bound of the names this page holds
+    bool loaded;
+    bool dirty;
+    std::set<std::string> names;
+
+    Page(uint64_t i, const std::string& f)
+        : id(i), first(f), loaded(false), dirty(false) {
+    }
+  };
+
+  std::atomic<bool> dirty_;
+  bool dir_dirty_;
+  std::atomic<uint64_t> dirty_since_us_;
+  std::atomic<uint64_t> pending_mutations_;
   int ref_;
   std::string meta_key_;
+  uint64_t next_page_id_;
+  std::vector<Page> pages_;
+  // Keys of pages no longer in the directory
+  std::vector<std::string> dropped_keys_;
+  std::atomic<uint64_t> mem_usage_;
+
+  void MarkDirty();
+  size_t FindPage(const std::string& name) const;
+  Status LoadPage(ZgwStore* store, Page* page);
+  void SplitPage(size_t index);
+  void DropPage(size_t index);
+  std::string EncodeDirectory() const;
+  Status ParseLegacyValue(std::string* value);
+};
+
+struct ListMapStats {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  uint64_t flushes;
+  uint64_t resident;
+  uint64_t resident_bytes;
+
+  ListMapStats()
+      : hits(0), misses(0), evictions(0), flushes(0),
+        resident(0), resident_bytes(0) {
+  }
+};
+
+struct ListMapOptions {
+  // Budget for resident name lists
+  uint64_t cache_bytes;
+  // Save a dirty list in Unref, before the request is answered
+  bool sync_flush;
+  // Flush a list once it has been dirty this long
+  uint64_t flush_interval_us;
+  // or has taken this many mutations
+  uint64_t flush_mutations;
+  // A clean unreferenced list loaded longer ago than this is read again
+  // on its next Ref, to pick up names other gateways changed. 0 never
+  // does, for a gateway that owns its cluster
+  uint64_t revalidate_us;
+
+  ListMapOptions()
+      : cache_bytes(256 << 20),
+        sync_flush(false),
+        flush_interval_us(1000000),
+        flush_mutations(1024),
+        revalidate_us(1000000) {
+  }
 };
 
+static const size_t kListMapShards = 16;
+
+// Name lists stay resident after their last Unref, the least recently
+// used clean ones are evicted once cache_bytes is exceeded, and clean
+// ones older than revalidate_us are read again. Dirty lists are written
+// behind by Flush unless sync_flush is set.
+//
+// Keys are hashed over shards, each with its own lock, LRU and part of
+// the budget. No zeppelin I/O is done under a shard lock, concurrent
+// Refs of a key being loaded wait for that one load
 class ListMap {
  public:
   enum KEY_TYPE {
     kBuckets,
     kObjects
   };
-  ListMap(KEY_TYPE key_type)
-      : key_type_(key_type) {
-  }
+  ListMap(KEY_TYPE key_type, const ListMapOptions& options);
+  ~ListMap();
 
   Status Ref(ZgwStore* store, const std::string key, NameList** names);
 
   Status Unref(ZgwStore* store, const std::string& key);
 
+  // Read the name list of key from zeppelin into a new NameList
   Status InitNameList(const std::string& key, ZgwStore* store, NameList** names);
 
+  // Save dirty lists due by the flush policy, all of them if force
+  Status Flush(ZgwStore* store, bool force);
+
+  // Some list has reached flush_mutations since the last Flush
+  bool flush_wanted() const {
+    return flush_wanted_.load();
+  }
+
+  void GetStats(ListMapStats* stats);
+
  private:
-  std::mutex ref_lock_;
-  //           key                ref    namelist
-  std::map<std::string, NameList*> map_list_;
+  struct Loading {
+    bool done;
+    Status status;
+
+    Loading() : done(false) {}
+  };
+
+  struct Entry {
+    // NULL while loading
+    NameList* list;
+    std::shared_ptr<Loading> loading;
+    // MemoryUsage of list when last unreferenced
+    uint64_t charge;
+    // When list was read from zeppelin
+    uint64_t loaded_us;
+    bool in_lru;
+    // Saves in progress outside ref_lock
+    int pins;
+    std::list<std::string>::iterator lru_pos;
+
+    Entry() : list(NULL), charge(0), loaded_us(0), in_lru(false), pins(0) {}
+  };
+
+  struct Shard {
+    std::mutex ref_lock;
+    std::condition_variable load_cond;
+    std::map<std::string, Entry> map_list;
+    // Unreferenced keys, most recently used first
+    std::list<std::string> lru;
+    uint64_t usage;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t flushes;
+
+    Shard() : usage(0), hits(0), misses(0), evictions(0), flushes(0) {}
+  };
+
   int key_type_;
+  ListMapOptions options_;
+  uint64_t shard_cache_bytes_;
+  Shard shards_[kListMapShards];
+  std::atomic<bool> flush_wanted_;
+
+  Shard* GetShard(const std::string& key);
+  Status FlushShard(ZgwStore* store, Shard* shard, bool force);
+  void Evict(Shard* shard);
+
+  // No copying allowed
+  ListMap(const ListMap&);
+  void operator=(const ListMap&);
 };
 
 }  // namespace libzgw
@@ -1,18 +1,25 @@
 #include "src/libzgw/zgw_object.h"
+
+#include <algorithm>
+#include <random>
+
 #include "slash/include/slash_coding.h"
+#include "slash/include/slash_string.h"
 
 namespace libzgw {
 
 static const std::string kObjectMetaPrefix = "__O__";
 static const std::string kObjectDataPrefix = "__o";
 static const std::string kObjectDataSep = "__";
-static const int kObjectDataStripLen = 1048576; // 1 MB
 
 ZgwObject::ZgwObject(const std::string& bucket_name, const std::string& name)
       : bucket_name_(bucket_name),
         name_(name),
         strip_len_(kObjectDataStripLen),
-        strip_count_(0) {
+        strip_count_(0),
+        generation_(0),
+        flags_(0),
+        placeholder3_(0) {
 }
 
 ZgwObject::ZgwObject(const std::string& bucket_name, const std::string& name,
@@ -22,13 +29,69 @@ ZgwObject::ZgwObject(const std::string& bucket_name, const std::string& name,
         content_(content),
         info_(i),
         strip_len_(kObjectDataStripLen),
-        placeholder1_(0),
-        placeholder2_(0),
+        generation_(0),
+        flags_(0),
         placeholder3_(0) {
   int m = content_.size() % strip_len_;
   strip_count_ = content_.size() / strip_len_ + (m > 0 ? 1 : 0);
 }
 
+uint32_t StripLenPolicy::StripLen(uint64_t object_size) const {
+  for (auto& c : classes) {
+    if (object_size <= c.first) {
+      return c.second;
+    }
+  }
+  return default_len;
+}
+
+static bool ValidStripLen(uint64_t len) {
+  return len >= kMinObjectDataStripLen && len <= kMaxObjectDataStripLen;
+}
+
+Status StripLenPolicy::Parse(uint32_t default_len, const std::string& classes,
+                             StripLenPolicy* policy) {
+  if (!ValidStripLen(default_len)) {
+    return Status::InvalidArgument("strip length out of range");
+  }
+  policy->default_len = default_len;
+  policy->classes.clear();
+
+  std::vector<std::string> items;
+  slash::StringSplit(classes, '/', items);
+  for (auto& item : items) {
+    unsigned long long max_kb, strip_kb;
+    char tail;
+    if (sscanf(item.c_str(), "%llu:%llu%c", &max_kb, &strip_kb, &tail) != 2 ||
+        !ValidStripLen(strip_kb << 10)) {
+      return Status::InvalidArgument("invalid strip length class: " + item);
+    }
+    if (!policy->classes.empty() &&
+        max_kb << 10 <= policy->classes.back().first) {
+      return Status::InvalidArgument("strip length classes not ascending");
+    }
+    policy->classes.push_back(std::make_pair(max_kb << 10,
+                                             static_cast<uint32_t>(strip_kb << 10)));
+  }
+  return Status::OK();
+}
+
+bool ResolveByteRange(int64_t first, uint64_t last, uint64_t size,
+                      uint64_t* offset, uint64_t* length) {
+  if (first < 0) {
+    // Suffix range
+    *length = std::min(static_cast<uint64_t>(-first), size);
+    *offset = size - *length;
+    return *length > 0;
+  }
+  if (static_cast<uint64_t>(first) >= size || last < static_cast<uint64_t>(first)) {
+    return false;
+  }
+  *offset = first;
+  *length = std::min(last, size - 1) - *offset + 1;
+  return true;
+}
+
 std::string ZgwObjectInfo::MetaValue() const {
   std::string result;
   slash::PutFixed64(&result, mtime.tv_sec);
@@ -69,26 +132,82 @@ std::string ZgwObject::MetaValue() const {
   std::string result;
   // Object Internal meta
   slash::PutFixed32(&result, strip_count_);
-  slash::PutFixed32(&result, placeholder1_);
+  // 0 for the old fixed length keeps such meta values as they were
+  slash::PutFixed32(&result, strip_len_ == kObjectDataStripLen ? 0 : strip_len_);
   slash::PutFixed32(&result, part_nums_.size());
   for (uint32_t i : part_nums_) {
     slash::PutFixed32(&result, i);
   }
-  slash::PutFixed32(&result, placeholder2_);
+  slash::PutFixed32(&result, flags_);
   slash::PutFixed32(&result, placeholder3_);
   slash::PutLengthPrefixedString(&result, upload_id_);
 
   // Object Info
   slash::PutLengthPrefixedString(&result, info_.MetaValue());
+
+  // Optional fields
+  if (flags_ & kObjectHasPartSizes) {
+    slash::PutFixed32(&result, part_sizes_.size());
+    for (uint64_t size : part_sizes_) {
+      slash::PutFixed64(&result, size);
+    }
+  }
+  if (flags_ & kObjectHasPartStripLens) {
+    for (uint32_t len : part_strip_lens_) {
+      slash::PutFixed32(&result, len);
+    }
+  }
+  if (flags_ & kObjectInline) {
+    slash::PutLengthPrefixedString(&result, inline_data_);
+  }
+  if (flags_ & kObjectContentAddressed) {
+    slash::PutLengthPrefixedString(&result, strip_digests_);
+  }
+  if (flags_ & kObjectHasGeneration) {
+    slash::PutFixed64(&result, generation_);
+  }
+  if (flags_ & kObjectHasPartGenerations) {
+    for (uint64_t generation : part_generations_) {
+      slash::PutFixed64(&result, generation);
+    }
+  }
   return result;
 }
 
 std::string ZgwObject::DataKey(int index) const {
+  if (flags_ & kObjectContentAddressed) {
+    static const char kHex[] = "0123456789abcdef";
+    std::string key(kContentStripPrefix);
+    key.reserve(key.size() + kStripDigestSize * 2);
+    const char* digest = strip_digests_.data() + index * kStripDigestSize;
+    for (size_t i = 0; i < kStripDigestSize; i++) {
+      key.push_back(kHex[(digest[i] >> 4) & 0xf]);
+      key.push_back(kHex[digest[i] & 0xf]);
+    }
+    return key;
+  }
+  if (generation_ != 0) {
+    char buf[24];
+    snprintf(buf, sizeof(buf), ".%016llx",
+             static_cast<unsigned long long>(generation_));
+    return bucket_name_ +
+      kObjectDataPrefix + std::to_string(index) + buf +
+      kObjectDataSep + name_;
+  }
   return bucket_name_ +
     kObjectDataPrefix + std::to_string(index) +
     kObjectDataSep + name_;
 }
 
+uint64_t ZgwObject::NewGeneration() {
+  static thread_local std::mt19937_64 rng(std::random_device{}());
+  uint64_t generation;
+  do {
+    generation = rng();
+  } while (generation == 0);
+  return generation;
+}
+
 std::string ZgwObject::NextDataStrip(uint32_t* iter) const {
   if (*iter > content_.size()) {
     return std::string();
@@ -102,7 +221,10 @@ std::string ZgwObject::NextDataStrip(uint32_t* iter) const {
 Status ZgwObject::ParseMetaValue(std::string* value) {
   // Object Interal meta
   slash::GetFixed32(value, &strip_count_);
-  slash::GetFixed32(value, &placeholder1_);
+  slash::GetFixed32(value, &strip_len_);
+  if (strip_len_ == 0) {
+    strip_len_ = kObjectDataStripLen;
+  }
   uint32_t n, v;
   slash::GetFixed32(value, &n);
   for (uint32_t i = 0; i < n; i++) {
@@ -110,7 +232,7 @@ Status ZgwObject::ParseMetaValue(std::string* value) {
     part_nums_.insert(v);
   }
 
-  slash::GetFixed32(value, &placeholder2_);
+  slash::GetFixed32(value, &flags_);
   slash::GetFixed32(value, &placeholder3_);
   bool res = slash::GetLengthPrefixedString(value, &upload_id_);
   if (!res) {
@@ -123,7 +245,128 @@ Status ZgwObject::ParseMetaValue(std::string* value) {
   if (!res) {
     return Status::Corruption("Parse ob_meta failed");
   }
-  return info_.ParseMetaValue(&ob_meta);
+  Status s = info_.ParseMetaValue(&ob_meta);
+  if (!s.ok()) {
+    return s;
+  }
+
+  // Optional fields
+  if (flags_ & kObjectHasPartSizes) {
+    uint64_t size;
+    slash::GetFixed32(value, &n);
+    if (n != part_nums_.size() || value->size() < n * sizeof(uint64_t)) {
+      return Status::Corruption("Parse part sizes failed");
+    }
+    part_sizes_.clear();
+    for (uint32_t i = 0; i < n; i++) {
+      slash::GetFixed64(value, &size);
+      part_sizes_.push_back(size);
+    }
+    BuildPartIndex();
+  }
+  if (flags_ & kObjectHasPartStripLens) {
+    // One per part, after the part sizes
+    if (!(flags_ & kObjectHasPartSizes) ||
+        value->size() < part_sizes_.size() * sizeof(uint32_t)) {
+      return Status::Corruption("Parse part strip lens failed");
+    }
+    part_strip_lens_.resize(part_sizes_.size());
+    for (auto& len : part_strip_lens_) {
+      slash::GetFixed32(value, &len);
+    }
+  }
+  if (flags_ & kObjectInline) {
+    if (!slash::GetLengthPrefixedString(value, &inline_data_)) {
+      return Status::Corruption("Parse inline data failed");
+    }
+  }
+  if (flags_ & kObjectContentAddressed) {
+    if (!slash::GetLengthPrefixedString(value, &strip_digests_) ||
+        strip_digests_.size() != strip_count_ * kStripDigestSize) {
+      return Status::Corruption("Parse strip digests failed");
+    }
+  }
+  if (flags_ & kObjectHasGeneration) {
+    if (value->size() < sizeof(uint64_t)) {
+      return Status::Corruption("Parse generation failed");
+    }
+    slash::GetFixed64(value, &generation_);
+  }
+  if (flags_ & kObjectHasPartGenerations) {
+    // One per part, after the part sizes
+    if (!(flags_ & kObjectHasPartSizes) ||
+        value->size() < part_sizes_.size() * sizeof(uint64_t)) {
+      return Status::Corruption("Parse part generations failed");
+    }
+    part_generations_.resize(part_sizes_.size());
+    for (auto& generation : part_generations_) {
+      slash::GetFixed64(value, &generation);
+    }
+  }
+  return Status::OK();
+}
+
+void ZgwObject::SetPartSizes(const std::vector<uint64_t>& sizes) {
+  assert(sizes.size() == part_nums_.size());
+  part_sizes_ = sizes;
+  flags_ |= kObjectHasPartSizes;
+  BuildPartIndex();
+}
+
+void ZgwObject::SetPartStripLens(const std::vector<uint32_t>& lens) {
+  assert(lens.size() == part_sizes_.size());
+  if (lens.empty()) {
+    return;
+  }
+  strip_len_ = lens[0];
+  if (std::count(lens.begin(), lens.end(), lens[0]) ==
+      static_cast<ptrdiff_t>(lens.size())) {
+    return;
+  }
+  part_strip_lens_ = lens;
+  flags_ |= kObjectHasPartStripLens;
+}
+
+void ZgwObject::SetPartGenerations(const std::vector<uint64_t>& generations) {
+  assert(generations.size() == part_sizes_.size());
+  if (std::count(generations.begin(), generations.end(), 0) ==
+      static_cast<ptrdiff_t>(generations.size())) {
+    return;
+  }
+  part_generations_ = generations;
+  flags_ |= kObjectHasPartGenerations;
+}
+
+void ZgwObject::BuildPartIndex() {
+  part_list_.assign(part_nums_.begin(), part_nums_.end());
+  part_offsets_.clear();
+  uint64_t offset = 0;
+  for (uint64_t size : part_sizes_) {
+    part_offsets_.push_back(offset);
+    offset += size;
+  }
+}
+
+size_t ZgwObject::PartIndex(uint64_t offset) const {
+  if (part_offsets_.empty() ||
+      offset >= part_offsets_.back() + part_sizes_.back()) {
+    return part_sizes_.size();
+  }
+  auto it = std::upper_bound(part_offsets_.begin(), part_offsets_.end(), offset);
+  return it - part_offsets_.begin() - 1;
+}
+
+ZgwObject ZgwObject::PartObject(size_t index) const {
+  ZgwObject part(bucket_name_, SubObjectName(InternalName(), part_list_[index]));
+  part.SetStripLen(part_strip_lens_.empty() ? strip_len_
+                                            : part_strip_lens_[index]);
+  if (!part_generations_.empty()) {
+    part.SetGeneration(part_generations_[index]);
+  }
+  part.info().size = part_sizes_[index];
+  uint64_t m = part_sizes_[index] % part.strip_len();
+  part.SetStripCount(part_sizes_[index] / part.strip_len() + (m > 0 ? 1 : 0));
+  return part;
 }
 
 void ZgwObject::ParseNextStrip(std::string* value) {
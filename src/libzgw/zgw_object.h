@@ -2,23 +2,109 @@
 #define ZGW_OBJECT_H
 
 #include <string>
+#include <vector>
+#include <set>
 #include <sys/time.h>
 
 #include "slash/include/slash_status.h"
 #include "src/libzgw/zgw_user.h"
-#include "src/libzgw/zgw_namelist.h"
 
 namespace libzgw {
 
 static const std::string kInternalObjectNamePrefix = "__";
+// Upload id is a md5 hex digest
+static const size_t kUploadIdSize = 32;
 static const std::string kInternalSubObjectNamePrefix = "__#";
 
+inline std::string SubObjectName(const std::string& internal_obname, int part_num) {
+  return kInternalSubObjectNamePrefix + std::to_string(part_num) + internal_obname;
+}
+
+// In progress uploads are also indexed in the object name list as
+// prefix + key + '\0' + upload id, which sorts by key then upload id even
+// where one key prefixes another. No upload name starts with the prefix
+// since object names never start with "__". The prefix alone marks the
+// index as complete
+static const std::string kInternalUploadIndexPrefix = "____";
+
+inline std::string UploadIndexName(const std::string& key,
+                                   const std::string& upload_id) {
+  return kInternalUploadIndexPrefix + key + '\0' + upload_id;
+}
+
+// Key and upload id of an index name, false if it is not one
+inline bool ParseUploadIndexName(const std::string& name, std::string* key,
+                                 std::string* upload_id) {
+  size_t pre = kInternalUploadIndexPrefix.size();
+  if (name.size() < pre + 1 + kUploadIdSize ||
+      name.compare(0, pre, kInternalUploadIndexPrefix) != 0 ||
+      name[name.size() - kUploadIdSize - 1] != '\0') {
+    return false;
+  }
+  key->assign(name, pre, name.size() - pre - kUploadIdSize - 1);
+  upload_id->assign(name, name.size() - kUploadIdSize, kUploadIdSize);
+  return true;
+}
+
 using slash::Status;
 
+// Strip length of objects that did not record one
+static const uint32_t kObjectDataStripLen = 1048576; // 1 MB
+static const uint32_t kMinObjectDataStripLen = 4096;
+static const uint32_t kMaxObjectDataStripLen = 64 << 20;
+// Largest object kept in its meta value. Listings Mget whole meta values
+// and the meta cache keeps them, so this stays small
+static const uint32_t kMaxObjectInlineSize = 64 << 10;
+// Key prefix of strips stored by content, in the data table for the strip
+// and in the meta table for its refcount
+static const std::string kContentStripPrefix = "__C__";
+// SHA-256 of a strip stored by content
+static const size_t kStripDigestSize = 32;
+
+// Strip length picked for a new object by its size: the first class whose
+// max size is not below it, default_len for objects above all classes
+struct StripLenPolicy {
+  uint32_t default_len;
+  // max object size : strip length, ascending by size
+  std::vector<std::pair<uint64_t, uint32_t>> classes;
+
+  StripLenPolicy()
+    : default_len(kObjectDataStripLen) {
+  }
+
+  uint32_t StripLen(uint64_t object_size) const;
+
+  // classes is "<max object KB>:<strip KB>/...", e.g. "4096:256/262144:4096"
+  static Status Parse(uint32_t default_len, const std::string& classes,
+                      StripLenPolicy* policy);
+};
+
+// Resolve a byte range of an object size bytes long to offset and length.
+// first < 0 asks for the last -first bytes, last is inclusive and cut to
+// the object. False if no byte of the object is in the range
+bool ResolveByteRange(int64_t first, uint64_t last, uint64_t size,
+                      uint64_t* offset, uint64_t* length);
+
 enum ObjectStorageClass {
   kStandard = 0,
 };
 
+// Bits of ZgwObject::flags_, each set bit means one more optional field
+// follows the object info in the meta value, in bit order
+enum ObjectMetaFlag {
+  kObjectHasPartSizes = 1 << 0,
+  // Parts do not all use strip_len()
+  kObjectHasPartStripLens = 1 << 1,
+  // Data is kept in the meta value, there are no strips
+  kObjectInline = 1 << 2,
+  // Strips are keyed by their digest and may be shared with other objects
+  kObjectContentAddressed = 1 << 3,
+  // Strip keys carry the generation of the write that stored them
+  kObjectHasGeneration = 1 << 4,
+  // After the part sizes, the generation of each part
+  kObjectHasPartGenerations = 1 << 5,
+};
+
 struct ZgwObjectInfo {
   timeval mtime;
   std::string etag;
@@ -86,10 +172,19 @@ class ZgwObject {
     return strip_len_;
   }
 
+  // Only before any strip is written
+  void SetStripLen(uint32_t len) {
+    strip_len_ = len;
+  }
+
   uint32_t strip_count() const {
     return strip_count_;
   }
 
+  void SetStripCount(uint32_t count) {
+    strip_count_ = count;
+  }
+
   std::string upload_id() const {
     return upload_id_;
   }
@@ -102,6 +197,92 @@ class ZgwObject {
     return part_nums_;
   }
 
+  const std::set<uint32_t> &part_nums() const {
+    return part_nums_;
+  }
+
+  bool is_inline() const {
+    return flags_ & kObjectInline;
+  }
+  const std::string& inline_data() const {
+    return inline_data_;
+  }
+  // Keep data in the meta value instead of strips, data is swapped in
+  void SetInlineData(std::string* data) {
+    inline_data_.swap(*data);
+    flags_ |= kObjectInline;
+    flags_ &= ~(kObjectContentAddressed | kObjectHasGeneration);
+    generation_ = 0;
+    strip_count_ = 0;
+    strip_digests_.clear();
+  }
+
+  bool content_addressed() const {
+    return flags_ & kObjectContentAddressed;
+  }
+  // Strips written from now on are keyed by the digests added
+  void SetContentAddressed() {
+    flags_ |= kObjectContentAddressed;
+  }
+  // Digest of the next strip, kStripDigestSize bytes
+  void AddStripDigest(const char* digest) {
+    strip_digests_.append(digest, kStripDigestSize);
+  }
+  const std::string& strip_digests() const {
+    return strip_digests_;
+  }
+  void SetStripDigests(const std::string& digests) {
+    strip_digests_ = digests;
+  }
+
+  // Strips of each write are keyed apart from those of earlier writes of
+  // the same name, so an object is never overwritten in place and its old
+  // strips can be deleted at any time. 0 for objects stored before, whose
+  // strip keys are the name and index alone
+  uint64_t generation() const {
+    return generation_;
+  }
+  // Only before any strip is written
+  void SetGeneration(uint64_t generation) {
+    generation_ = generation;
+    if (generation_ != 0) {
+      flags_ |= kObjectHasGeneration;
+    } else {
+      flags_ &= ~kObjectHasGeneration;
+    }
+  }
+  // Random and never 0
+  static uint64_t NewGeneration();
+
+  // Part layout of a completed multipart object, indexed in part_nums() order
+  bool has_part_sizes() const {
+    return flags_ & kObjectHasPartSizes;
+  }
+  void SetPartSizes(const std::vector<uint64_t>& sizes);
+  // After SetPartSizes, recorded only if they differ from each other
+  void SetPartStripLens(const std::vector<uint32_t>& lens);
+  // After SetPartSizes, recorded only if any is not 0
+  void SetPartGenerations(const std::vector<uint64_t>& generations);
+  size_t part_count() const {
+    return part_sizes_.size();
+  }
+  uint64_t PartOffset(size_t index) const {
+    return part_offsets_[index];
+  }
+  // Index of the part holding byte offset, part_count() if out of range
+  size_t PartIndex(uint64_t offset) const;
+  // Sub object of part index, with strip count and size filled
+  ZgwObject PartObject(size_t index) const;
+
+  // Name prefix shared by all sub objects of a multipart object
+  std::string InternalName() const {
+    if (name_.compare(0, kInternalObjectNamePrefix.size(),
+                      kInternalObjectNamePrefix) == 0) {
+      return name_;
+    }
+    return kInternalObjectNamePrefix + name_ + upload_id_;
+  }
+
   // Serialization
   std::string MetaKey() const;
   std::string MetaValue() const;
@@ -117,17 +298,29 @@ class ZgwObject {
   std::string name_;
   std::string content_;
   ZgwObjectInfo info_;
-  const uint32_t strip_len_;
+  // Stored in the first reserved field, 0 there means kObjectDataStripLen.
+  // For a completed multipart object, the strip length of its parts
+  uint32_t strip_len_;
   uint32_t strip_count_;
 
   // Multipart Upload
   std::set<uint32_t> part_nums_;
   std::string upload_id_; // md5(object_name + timestamp)
+  std::vector<uint64_t> part_sizes_;
+  std::vector<uint32_t> part_strip_lens_;
+  std::string inline_data_;
+  std::string strip_digests_;
+  uint64_t generation_;
+  std::vector<uint64_t> part_generations_;
+  // Derived from part_sizes_ when set or parsed
+  std::vector<uint32_t> part_list_;
+  std::vector<uint64_t> part_offsets_;
 
   // Reserve for compatibility
-  uint32_t placeholder1_;
-  uint32_t placeholder2_;
+  uint32_t flags_; // ObjectMetaFlag bits, was placeholder2
   uint32_t placeholder3_;
+
+  void BuildPartIndex();
 };
 
 }  // namespace libzgw
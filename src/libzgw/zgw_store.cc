@@ -1,24 +1,42 @@
 #include "src/libzgw/zgw_store.h"
 
 #include <unistd.h>
+#include <mutex>
+#include <functional>
 
+#include "slash/include/slash_coding.h"
 #include "slash/include/slash_string.h"
+#include "slash/include/env.h"
 
 namespace libzgw {
 
-ZgwStore::ZgwStore() {
+ZgwStore::ZgwStore(const ZgwStoreOptions& options)
+    : options_(options),
+      backend_(NULL),
+      strip_pool_(NULL),
+      user_table_(options.user_table),
+      own_user_table_(false),
+      io_micros_(0),
+      trace_(NULL) {
+  if (user_table_ == NULL) {
+    user_table_ = new ZgwUserTable();
+    own_user_table_ = true;
+  }
 }
 
 ZgwStore::~ZgwStore() {
-  delete zp_;
-  for (auto &item : access_key_user_map_) {
-    delete item.second;
+  delete strip_pool_;
+  delete backend_;
+  users_.reset();
+  listed_users_.reset();
+  if (own_user_table_) {
+    delete user_table_;
   }
 }
 
-Status ZgwStore::Open(const std::vector<std::string>& ip_ports, ZgwStore** ptr) {
-  ZgwStore* zgw_store = new ZgwStore();
-  Status s = zgw_store->Init(ip_ports);
+Status ZgwStore::Open(const ZgwStoreOptions& options, ZgwStore** ptr) {
+  ZgwStore* zgw_store = new ZgwStore(options);
+  Status s = zgw_store->Init();
   if (!s.ok()) {
     delete zgw_store;
   }
@@ -26,7 +44,13 @@ Status ZgwStore::Open(const std::vector<std::string>& ip_ports, ZgwStore** ptr)
   return s;
 }
 
-Status ZgwStore::Init(const std::vector<std::string>& ip_ports) {
+Status ZgwStore::NewBackend(ZgwBackend** backend) {
+  if (options_.mem_store != NULL) {
+    *backend = new MemBackend(options_.mem_store);
+    return Status::OK();
+  }
+
+  const std::vector<std::string>& ip_ports = options_.zp_meta_ip_ports;
   if (ip_ports.empty()) {
     return Status::InvalidArgument("no meta ip provided");
   }
@@ -40,14 +64,36 @@ Status ZgwStore::Init(const std::vector<std::string>& ip_ports) {
     }
     zp_option.meta_addr.push_back(libzp::Node(t_ip, t_port));
   }
-  zp_ = new libzp::Cluster(zp_option);
-  assert(zp_);
+  *backend = new ZpBackend(zp_option);
+  return Status::OK();
+}
+
+Status ZgwStore::Init() {
+  Status s = NewBackend(&backend_);
+  if (!s.ok()) {
+    return s;
+  }
+  if (options_.strip_io_window > 1) {
+    std::vector<ZgwBackend*> backends;
+    for (int i = 0; i < options_.strip_io_window; i++) {
+      ZgwBackend* backend;
+      s = NewBackend(&backend);
+      if (!s.ok()) {
+        for (auto b : backends) {
+          delete b;
+        }
+        return s;
+      }
+      backends.push_back(backend);
+    }
+    strip_pool_ = new StripPool(backends);
+  }
 
   // Find meta and data tables
   std::vector<std::string> tables;
   bool meta_table_found = false;
   bool data_table_found = false;
-  Status s = zp_->ListTable(&tables);
+  s = backend_->ListTable(&tables);
   if (s.IsIOError()) {
     return s;
   }
@@ -63,10 +109,10 @@ Status ZgwStore::Init(const std::vector<std::string>& ip_ports) {
   Status s1 = Status::OK();
   s = Status::OK();
   if (!meta_table_found) {
-    s = zp_->CreateTable(kZgwMetaTableName, kZgwTablePartitionNum);
+    s = backend_->CreateTable(kZgwMetaTableName, kZgwTablePartitionNum);
   }
   if (!data_table_found) {
-    s1 = zp_->CreateTable(kZgwDataTableName, kZgwTablePartitionNum);
+    s1 = backend_->CreateTable(kZgwDataTableName, kZgwTablePartitionNum);
   }
   if (s.IsIOError()) {
     return s;
@@ -76,8 +122,7 @@ Status ZgwStore::Init(const std::vector<std::string>& ip_ports) {
     // Alread create
   }
   if (!meta_table_found || !data_table_found) {
-    // Waiting for table created
-    sleep(10);
+    backend_->WaitForNewTables();
   }
 
   // Load all users
@@ -89,14 +134,38 @@ Status ZgwStore::Init(const std::vector<std::string>& ip_ports) {
   return Status::OK();
 }
 
-Status ZgwStore::SaveNameList(const NameList* nlist) {
-  return zp_->Set(kZgwMetaTableName, nlist->MetaKey(), nlist->MetaValue());
+Status ZgwStore::SaveNameList(NameList* nlist) {
+  std::lock_guard<std::mutex> save(nlist->save_lock);
+  std::vector<std::pair<std::string, std::string>> updates;
+  std::vector<std::string> deletes;
+  nlist->TakeDirty(&updates, &deletes);
+  Status s;
+  for (auto& kv : updates) {
+    s = ZpSet(kZgwMetaTableName, kv.first, kv.second);
+    if (!s.ok()) {
+      // Write all loaded pages again next time
+      nlist->SaveFailed(&deletes);
+      return s;
+    }
+  }
+  // Pages left out of the directory just written
+  std::vector<std::string> failed;
+  for (auto& key : deletes) {
+    s = ZpDelete(kZgwMetaTableName, key);
+    if (!s.ok() && !s.IsNotFound()) {
+      failed.push_back(key);
+    }
+  }
+  if (!failed.empty()) {
+    nlist->DeleteFailed(&failed);
+  }
+  return Status::OK();
 }
 
 Status ZgwStore::GetNameList(NameList* nlist) {
   Status s;
   std::string meta_value;
-  s = zp_->Get(kZgwMetaTableName, nlist->MetaKey(), &meta_value);
+  s = ZpGet(kZgwMetaTableName, nlist->MetaKey(), &meta_value);
   if (s.ok()) {
     return nlist->ParseMetaValue(&meta_value);
   } else if (s.IsNotFound()) {
@@ -105,4 +174,218 @@ Status ZgwStore::GetNameList(NameList* nlist) {
   return s;
 }
 
+void ZgwStore::RecordIo(ZgwSpan::Op op, const std::string& table,
+                        const std::string& key, uint64_t key_size,
+                        uint64_t value_size, uint64_t start_us,
+                        const Status& s) {
+  uint64_t micros = slash::NowMicros() - start_us;
+  io_micros_ += micros;
+  if (trace_ == NULL) {
+    return;
+  }
+  ZgwSpan span;
+  span.op = op;
+  span.table = table.c_str();
+  span.key = key;
+  span.key_size = key_size;
+  span.value_size = value_size;
+  span.start_us = start_us;
+  span.micros = micros;
+  span.ok = s.ok() || s.IsNotFound();
+  trace_->Add(std::move(span));
+}
+
+Status ZgwStore::ZpGet(const std::string& table, const std::string& key,
+                       std::string* value) {
+  uint64_t start = slash::NowMicros();
+  Status s = backend_->Get(table, key, value);
+  RecordIo(ZgwSpan::kGet, table, key, key.size(), s.ok() ? value->size() : 0,
+           start, s);
+  return s;
+}
+
+Status ZgwStore::ZpSet(const std::string& table, const std::string& key,
+                       const std::string& value) {
+  uint64_t start = slash::NowMicros();
+  Status s = backend_->Set(table, key, value);
+  RecordIo(ZgwSpan::kSet, table, key, key.size(), value.size(), start, s);
+  return s;
+}
+
+Status ZgwStore::ZpDelete(const std::string& table, const std::string& key) {
+  uint64_t start = slash::NowMicros();
+  Status s = backend_->Delete(table, key);
+  RecordIo(ZgwSpan::kDelete, table, key, key.size(), 0, start, s);
+  return s;
+}
+
+Status ZgwStore::ZpMget(const std::string& table,
+                        const std::vector<std::string>& keys,
+                        std::map<std::string, std::string>* values) {
+  uint64_t start = slash::NowMicros();
+  Status s = backend_->Mget(table, keys, values);
+  uint64_t key_size = 0, value_size = 0;
+  for (auto& key : keys) {
+    key_size += key.size();
+  }
+  for (auto& kv : *values) {
+    value_size += kv.second.size();
+  }
+  RecordIo(ZgwSpan::kMget, table, keys.empty() ? "" : keys.front(),
+           key_size, value_size, start, s);
+  return s;
+}
+
+StripResult ZgwStore::WaitStrip(std::future<StripResult>* result,
+                                const std::string& table) {
+  uint64_t start = slash::NowMicros();
+  StripResult res = result->get();
+  io_micros_ += slash::NowMicros() - start;
+  // Done on the strip pool, strips done inline are traced by ZpGet/ZpSet
+  if (trace_ != NULL && res.span.start_us != 0) {
+    res.span.table = table.c_str();
+    trace_->Add(std::move(res.span));
+  }
+  return res;
+}
+
+Status ZgwStore::GetNameListPage(const std::string& page_key, std::string* value) {
+  return ZpGet(kZgwMetaTableName, page_key, value);
+}
+
+size_t ZgwStore::strip_window() const {
+  return strip_pool_ ? strip_pool_->window() : 1;
+}
+
+std::future<StripResult> ZgwStore::AsyncSetStrip(const std::string& key,
+                                                 std::string value) {
+  if (strip_pool_) {
+    return strip_pool_->Set(kZgwDataTableName, key, std::move(value));
+  }
+  std::promise<StripResult> done;
+  StripResult res;
+  res.status = ZpSet(kZgwDataTableName, key, value);
+  done.set_value(std::move(res));
+  return done.get_future();
+}
+
+std::future<StripResult> ZgwStore::AsyncGet(const std::string& table,
+                                            const std::string& key) {
+  if (strip_pool_) {
+    return strip_pool_->Get(table, key);
+  }
+  std::promise<StripResult> done;
+  StripResult res;
+  res.status = ZpGet(table, key, &res.value);
+  done.set_value(std::move(res));
+  return done.get_future();
+}
+
+// Refcount updates of one content strip are serialized in the process
+static const size_t kContentStripLocks = 64;
+static std::mutex content_strip_mu[kContentStripLocks];
+
+static std::mutex* ContentStripLock(const std::string& key) {
+  return &content_strip_mu[std::hash<std::string>()(key) % kContentStripLocks];
+}
+
+// Add delta to the refcount of a content strip, NotFound if it has none.
+// The strip is deleted with its last reference
+static Status AddContentRef(ZgwBackend* backend, const std::string& key,
+                            int delta) {
+  std::string value;
+  Status s = backend->Get(kZgwMetaTableName, key, &value);
+  if (!s.ok()) {
+    return s;
+  }
+  uint64_t refs = value.size() == sizeof(uint64_t)
+    ? slash::DecodeFixed64(value.data()) : 0;
+  if (delta < 0 && refs <= static_cast<uint64_t>(-delta)) {
+    // Refcount first, a failure in between only leaks the strip
+    s = backend->Delete(kZgwMetaTableName, key);
+    if (s.ok()) {
+      s = backend->Delete(kZgwDataTableName, key);
+    }
+    return s;
+  }
+  value.clear();
+  slash::PutFixed64(&value, refs + delta);
+  return backend->Set(kZgwMetaTableName, key, value);
+}
+
+std::future<StripResult> ZgwStore::ScheduleStrip(
+    std::function<StripResult(ZgwBackend*)> func) {
+  if (strip_pool_) {
+    return strip_pool_->Schedule(std::move(func));
+  }
+  std::promise<StripResult> done;
+  StripResult res = func(backend_);
+  io_micros_ += res.span.micros;
+  done.set_value(std::move(res));
+  return done.get_future();
+}
+
+std::future<StripResult> ZgwStore::AsyncPutContentStrip(const std::string& key,
+                                                        std::string value) {
+  auto shared_value = std::make_shared<std::string>(std::move(value));
+  return ScheduleStrip([key, shared_value](ZgwBackend* backend) {
+    StripResult res;
+    res.span.op = ZgwSpan::kSet;
+    res.span.start_us = slash::NowMicros();
+    {
+      std::lock_guard<std::mutex> lock(*ContentStripLock(key));
+      res.status = AddContentRef(backend, key, 1);
+      if (res.status.IsNotFound()) {
+        // Data before the refcount, so a counted strip always exists
+        res.status = backend->Set(kZgwDataTableName, key, *shared_value);
+        if (res.status.ok()) {
+          std::string refs;
+          slash::PutFixed64(&refs, 1);
+          res.status = backend->Set(kZgwMetaTableName, key, refs);
+        }
+        res.span.value_size = shared_value->size();
+      }
+    }
+    res.span.micros = slash::NowMicros() - res.span.start_us;
+    res.span.key = key;
+    res.span.key_size = key.size();
+    res.span.ok = res.status.ok();
+    return res;
+  });
+}
+
+std::future<StripResult> ZgwStore::AsyncRefContentStrip(const std::string& key) {
+  return ScheduleStrip([key](ZgwBackend* backend) {
+    StripResult res;
+    res.span.op = ZgwSpan::kSet;
+    res.span.start_us = slash::NowMicros();
+    {
+      std::lock_guard<std::mutex> lock(*ContentStripLock(key));
+      res.status = AddContentRef(backend, key, 1);
+    }
+    res.span.micros = slash::NowMicros() - res.span.start_us;
+    res.span.key = key;
+    res.span.key_size = key.size();
+    res.span.ok = res.status.ok();
+    return res;
+  });
+}
+
+Status ZgwStore::DropStrip(const std::string& key) {
+  if (key.compare(0, kContentStripPrefix.size(), kContentStripPrefix) != 0) {
+    return ZpDelete(kZgwDataTableName, key);
+  }
+  uint64_t start = slash::NowMicros();
+  Status s;
+  {
+    std::lock_guard<std::mutex> lock(*ContentStripLock(key));
+    s = AddContentRef(backend_, key, -1);
+  }
+  if (s.IsNotFound()) {
+    s = Status::OK();
+  }
+  RecordIo(ZgwSpan::kDelete, kZgwMetaTableName, key, key.size(), 0, start, s);
+  return s;
+}
+
 }  // namespace libzgw
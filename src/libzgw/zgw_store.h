@@ -3,14 +3,21 @@
 
 #include <string>
 #include <vector>
+#include <map>
+#include <future>
 
 #include "slash/include/slash_status.h"
 
-#include "libzp/include/zp_cluster.h"
+#include "src/libzgw/zgw_backend.h"
 #include "src/libzgw/zgw_bucket.h"
 #include "src/libzgw/zgw_object.h"
 #include "src/libzgw/zgw_user.h"
 #include "src/libzgw/zgw_namelist.h"
+#include "src/libzgw/zgw_strip_pool.h"
+#include "src/libzgw/zgw_strip_gc.h"
+#include "src/libzgw/zgw_strip_cache.h"
+#include "src/libzgw/zgw_meta_cache.h"
+#include "src/libzgw/zgw_trace.h"
 
 using slash::Status;
 
@@ -24,19 +31,59 @@ class NameList;
 class ZgwObjectInfo;
 class ZgwObject;
 
+struct ZgwStoreOptions {
+  std::vector<std::string> zp_meta_ip_ports;
+  // Max strip Set/Get in flight for one object, 1 means serial I/O
+  int strip_io_window;
+  // Shared by all stores of the process, a private one if NULL
+  ZgwUserTable* user_table;
+  // Strip length of new objects
+  StripLenPolicy strip_len_policy;
+  // Objects up to this size are kept in their meta value, 0 for none
+  uint64_t inline_max_size;
+  // Strips of new objects are keyed by their SHA-256 and refcounted, so
+  // identical strips are stored once
+  bool content_addressed;
+  // Keep everything in memory instead of zeppelin if not NULL,
+  // zp_meta_ip_ports is not used then
+  MemStore* mem_store;
+  // Stale strips are deleted in the background if not NULL
+  StripGc* strip_gc;
+  // Strips read are cached here if not NULL, shared by all stores
+  StripCache* strip_cache;
+  // Object metas read by GetCachedObject are cached here if not NULL,
+  // shared by all stores
+  MetaCache* meta_cache;
+
+  ZgwStoreOptions()
+    : strip_io_window(4),
+      user_table(NULL),
+      inline_max_size(0),
+      content_addressed(false),
+      mem_store(NULL),
+      strip_gc(NULL),
+      strip_cache(NULL),
+      meta_cache(NULL) {
+  }
+};
+
 class ZgwStore {
 public:
-  static Status Open(const std::vector<std::string>& ips, ZgwStore** ptr);
+  static Status Open(const ZgwStoreOptions& options, ZgwStore** ptr);
   ~ZgwStore();
 
   // Operation On Service
+  // Reload users if the user list changed since the shared snapshot
   Status LoadAllUsers();
   Status AddUser(const std::string &user_name,
                  std::string *access_key, std::string *secret_key);
+  // user stays valid until the next GetUser on this store
   Status GetUser(const std::string &access_key, ZgwUser **user);
+  // Users stay valid until the next ListUsers on this store
   Status ListUsers(std::set<ZgwUser *> *user_list);
-  Status SaveNameList(const NameList* nlist);
+  Status SaveNameList(NameList* nlist);
   Status GetNameList(NameList* nlist);
+  Status GetNameListPage(const std::string& page_key, std::string* value);
   
   // Operation On Buckets
   Status GetBucket(ZgwBucket* bucket);
@@ -47,13 +94,22 @@ public:
   // Operation On Objects
   Status AddObject(ZgwObject& object);
   Status GetObject(ZgwObject* object, bool need_content = false);
+  // Meta of object, from the meta cache while it is fresh there. May be
+  // up to the cache ttl behind writes of other gateways, so only for
+  // answering reads, anything that writes back reads with GetObject
+  Status GetCachedObject(ZgwObject* object);
   Status ListObjects(const std::string& bucket_name,
                      const std::vector<std::string>&
                      candidate_names, std::vector<ZgwObject>* objects);
-  Status GetPartialObject(ZgwObject* object, std::vector<std::pair<int, uint32_t>>& segments);
+  // Append the byte ranges to object's content, each is resolved in
+  // place to its first and last byte, see ResolveByteRange
+  Status GetPartialObject(ZgwObject* object,
+                          std::vector<std::pair<int64_t, uint64_t>>& segments);
   Status DelObject(const std::string &bucket_name, const std::string &object_name);
+  // Register a part whose data was written by ZgwObjectWriter under
+  // SubObjectName(internal_obname, part_num)
   Status UploadPart(const std::string& bucket_name, const std::string& internal_obname,
-                    const ZgwObjectInfo& info, const std::string& content, int part_num);
+                    int part_num);
   Status ListParts(const std::string& bucket_name, const std::string& internal_obname,
                    std::vector<std::pair<int, ZgwObject>> *parts);
   Status CompleteMultiUpload(const std::string& bucket_name,
@@ -61,16 +117,104 @@ public:
                              const std::vector<std::pair<int, ZgwObject>>& parts,
                              std::string *final_etag);
 
+  // Microseconds this store has spent waiting on zeppelin so far
+  uint64_t io_micros() const {
+    return io_micros_;
+  }
+
+  // zeppelin calls are added to trace until it is set to NULL
+  void set_trace(ZgwTrace* trace) {
+    trace_ = trace;
+  }
+
 private:
-  ZgwStore();
-  Status Init(const std::vector<std::string>& ips);
-  libzp::Cluster* zp_;
-  ZgwUserList user_list_;
-  std::map<std::string, ZgwUser*> access_key_user_map_;
+  friend class ZgwObjectWriter;
+  friend class ZgwObjectReader;
+  friend class StripGc;
+
+  ZgwStore(const ZgwStoreOptions& options);
+  Status Init();
+  Status NewBackend(ZgwBackend** backend);
+  ZgwStoreOptions options_;
+  ZgwBackend* backend_;
+  StripPool* strip_pool_;
+  ZgwUserTable* user_table_;
+  bool own_user_table_;
+  // Snapshot this store reads, refreshed when the table generation moves
+  std::shared_ptr<const ZgwUserSnapshot> users_;
+  // Snapshot the last ListUsers result points into
+  std::shared_ptr<const ZgwUserSnapshot> listed_users_;
+  // Unknown access key : table generation it was missed at
+  std::unordered_map<std::string, uint64_t> unknown_keys_;
+  uint64_t io_micros_;
+  ZgwTrace* trace_;
 
-  Status BuildMap();
+  // backend_ calls, timed into io_micros_ and traced
+  void RecordIo(ZgwSpan::Op op, const std::string& table,
+                const std::string& key, uint64_t key_size,
+                uint64_t value_size, uint64_t start_us, const Status& s);
+  Status ZpGet(const std::string& table, const std::string& key,
+               std::string* value);
+  Status ZpSet(const std::string& table, const std::string& key,
+               const std::string& value);
+  Status ZpDelete(const std::string& table, const std::string& key);
+  Status ZpMget(const std::string& table, const std::vector<std::string>& keys,
+                std::map<std::string, std::string>* values);
+
+  Status ReloadUsers();
+  const ZgwUserSnapshot* RefreshUsers();
   std::string GetRandomKey(int width);
-  Status GetPartialObject(ZgwObject* object, int start, int end);
+  // Read the old meta of object first to reclaim its stale strips
+  Status SetObjectMeta(const ZgwObject& object);
+  // old_object is the meta object replaces, NULL if there was none
+  Status SetObjectMeta(const ZgwObject& object, const ZgwObject* old_object);
+  // Delete the strips of old_object, through the strip gc if there is one
+  void ReclaimStrips(const ZgwObject& old_object);
+  // Same for strip data keys, which are taken
+  void ReclaimKeys(std::vector<std::string>* keys);
+
+  uint32_t StripLenFor(uint64_t object_size) const {
+    return options_.strip_len_policy.StripLen(object_size);
+  }
+  uint64_t inline_max_size() const {
+    return options_.inline_max_size;
+  }
+  bool content_addressed() const {
+    return options_.content_addressed;
+  }
+  StripCache* strip_cache() const {
+    return options_.strip_cache;
+  }
+  // Once the object meta at meta_key was written or deleted, whether or
+  // not that succeeded
+  void MetaChanged(const std::string& meta_key) {
+    if (options_.meta_cache != NULL) {
+      options_.meta_cache->Invalidate(meta_key);
+    }
+  }
+  // Strip I/O, overlapped on strip_pool_ if the window is larger than 1
+  size_t strip_window() const;
+  std::future<StripResult> AsyncSetStrip(const std::string& key, std::string value);
+  std::future<StripResult> AsyncGetStrip(const std::string& key) {
+    return AsyncGet(kZgwDataTableName, key);
+  }
+  std::future<StripResult> AsyncGet(const std::string& table,
+                                    const std::string& key);
+  // Strips stored by content, key is ZgwObject::DataKey of one. The
+  // refcount is updated under a lock of this process, zeppelin has no
+  // compare and set, so one gateway must own the cluster as ObjectLock
+  // already assumes. Storing a strip that exists only adds a reference
+  std::future<StripResult> AsyncPutContentStrip(const std::string& key,
+                                                std::string value);
+  // One more reference to a stored strip, NotFound if there is none
+  std::future<StripResult> AsyncRefContentStrip(const std::string& key);
+  // Delete a strip, or drop one reference if it is stored by content
+  Status DropStrip(const std::string& key);
+  // func runs on strip_pool_, or inline if there is none
+  std::future<StripResult> ScheduleStrip(std::function<StripResult(ZgwBackend*)> func);
+  // Wait for an async Get or Set, timed into io_micros_ and traced
+  StripResult WaitStrip(std::future<StripResult>* result,
+                        const std::string& table = kZgwDataTableName);
 };
 
 }  // namespace libzgw
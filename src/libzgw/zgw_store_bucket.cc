@@ -11,11 +11,11 @@ Status ZgwStore::AddBucket(const std::string& bucket_name, const ZgwUserInfo& us
   // Add Bucket Meta
   ZgwBucket bucket(bucket_name);
   bucket.SetUserInfo(user_info);
-  return zp_->Set(kZgwMetaTableName, bucket.MetaKey(), bucket.MetaValue());
+  return ZpSet(kZgwMetaTableName, bucket.MetaKey(), bucket.MetaValue());
 }
 
 Status ZgwStore::DelBucket(const std::string &name) {
-  return zp_->Delete(kZgwMetaTableName, ZgwBucket(name).MetaKey());
+  return ZpDelete(kZgwMetaTableName, ZgwBucket(name).MetaKey());
 }
 
 Status ZgwStore::GetBucket(ZgwBucket* bucket) {
@@ -23,7 +23,7 @@ Status ZgwStore::GetBucket(ZgwBucket* bucket) {
   Status s;
   std::string meta_value;
 
-  s = zp_->Get(kZgwMetaTableName, bucket->MetaKey(), &meta_value);
+  s = ZpGet(kZgwMetaTableName, bucket->MetaKey(), &meta_value);
   if (!s.ok()) {
     return s;
   }
@@ -42,7 +42,7 @@ Status ZgwStore::ListBucket(const std::set<std::string>& name_list,
     keys.push_back(b.MetaKey());
     buckets->push_back(std::move(b));
   }
-  s = zp_->Mget(kZgwMetaTableName, keys, &values);
+  s = ZpMget(kZgwMetaTableName, keys, &values);
   if (!s.ok()) {
     return s;
   }
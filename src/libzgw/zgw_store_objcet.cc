@@ -2,37 +2,85 @@
 
 #include <unistd.h>
 #include <set>
+#include <deque>
 
 #include <openssl/md5.h>
 #include "slash/include/slash_string.h"
+#include "src/libzgw/zgw_stream.h"
 
 namespace libzgw {
 
 Status ZgwStore::AddObject(ZgwObject& object) {
   // Set Object Data
+  if (object.strip_count() > 0 && !object.content_addressed()) {
+    object.SetGeneration(ZgwObject::NewGeneration());
+  }
   Status s;
   std::string dvalue;
   uint32_t index = 0, iter = 0;
+  std::deque<std::future<StripResult>> inflight;
   while (!(dvalue = object.NextDataStrip(&iter)).empty()) {
-    s = zp_->Set(kZgwDataTableName, object.DataKey(index++), dvalue);
+    inflight.push_back(AsyncSetStrip(object.DataKey(index++), std::move(dvalue)));
+    if (inflight.size() < strip_window()) {
+      continue;
+    }
+    s = WaitStrip(&inflight.front()).status;
+    inflight.pop_front();
     if (!s.ok()) {
       return s;
     }
   }
+  for (auto& f : inflight) {
+    StripResult res = WaitStrip(&f);
+    if (!res.status.ok()) {
+      return res.status;
+    }
+  }
+
+  return SetObjectMeta(object);
+}
 
-  // Delete Old Data, since the object name may already exist
+Status ZgwStore::SetObjectMeta(const ZgwObject& object) {
+  // The object name may already exist
   std::string ometa;
-  libzgw::ZgwObject old_object(object.bucket_name(), object.name());
-  s = zp_->Get(kZgwMetaTableName, object.MetaKey(), &ometa);
+  ZgwObject old_object(object.bucket_name(), object.name());
+  Status s = ZpGet(kZgwMetaTableName, object.MetaKey(), &ometa);
   if (s.ok()) {
-    old_object.ParseMetaValue(&ometa);
-    for (uint32_t ti = object.strip_count(); ti < old_object.strip_count(); ti++) {
-      zp_->Delete(kZgwDataTableName, old_object.DataKey(ti));
-    }
+    s = old_object.ParseMetaValue(&ometa);
+  }
+  return SetObjectMeta(object, s.ok() ? &old_object : NULL);
+}
+
+Status ZgwStore::SetObjectMeta(const ZgwObject& object,
+                               const ZgwObject* old_object) {
+  Status s = ZpSet(kZgwMetaTableName, object.MetaKey(), object.MetaValue());
+  MetaChanged(object.MetaKey());
+  if (s.ok() && old_object != NULL && strip_cache() != NULL) {
+    strip_cache()->Erase(*old_object);
   }
+  if (s.ok() && old_object != NULL) {
+    // New strips never take the keys of old ones, see ZgwObject::generation
+    ReclaimStrips(*old_object);
+  }
+  return s;
+}
+
+void ZgwStore::ReclaimStrips(const ZgwObject& old_object) {
+  std::vector<std::string> keys;
+  for (uint32_t i = 0; i < old_object.strip_count(); i++) {
+    keys.push_back(old_object.DataKey(i));
+  }
+  ReclaimKeys(&keys);
+}
 
-  // Set Object Meta
-  return zp_->Set(kZgwMetaTableName, object.MetaKey(), object.MetaValue());
+void ZgwStore::ReclaimKeys(std::vector<std::string>* keys) {
+  if (keys->empty() ||
+      (options_.strip_gc != NULL && options_.strip_gc->Add(keys))) {
+    return;
+  }
+  for (auto& key : *keys) {
+    DropStrip(key);
+  }
 }
 
 Status ZgwStore::DelObject(const std::string &bucket_name,
@@ -40,105 +88,45 @@ Status ZgwStore::DelObject(const std::string &bucket_name,
   // Check meta exist
   ZgwObject object(bucket_name, object_name);
   std::string ob_meta_value;
-  Status s = zp_->Get(kZgwMetaTableName, object.MetaKey(), &ob_meta_value);
+  Status s = ZpGet(kZgwMetaTableName, object.MetaKey(), &ob_meta_value);
+  if (!s.ok()) {
+    return s;
+  }
+
+  // Parse from value
+  s = object.ParseMetaValue(&ob_meta_value);
   if (!s.ok()) {
     return s;
   }
 
   // Delete subobject if it was a multipart object
   for (uint32_t n : object.part_nums()) {
-    std::string internal_obname = object.name();
-    if (object_name.find_first_of(kInternalObjectNamePrefix) != 0) {
-      internal_obname = kInternalObjectNamePrefix + object.name() + object.upload_id();
-    }
-    std::string subobject_name = kInternalSubObjectNamePrefix +
-      std::to_string(n) + internal_obname;
-    s = DelObject(bucket_name, subobject_name);
-    if (!s.ok()) {
+    s = DelObject(bucket_name, SubObjectName(object.InternalName(), n));
+    if (!s.ok() && !s.IsNotFound()) {
       return s;
     }
   }
 
   // Delete Object Meta
-  s = zp_->Delete(kZgwMetaTableName, object.MetaKey());
-  if (!s.ok()) {
-    return s;
-  }
-
-  // Parse from value
-  s = object.ParseMetaValue(&ob_meta_value);
+  s = ZpDelete(kZgwMetaTableName, object.MetaKey());
+  MetaChanged(object.MetaKey());
   if (!s.ok()) {
     return s;
   }
 
   // Delete Object Data
-  uint32_t index = 0;
-  for (; index < object.strip_count(); index++) {
-    zp_->Delete(kZgwDataTableName, object.DataKey(index));
-  }
-  return Status::OK();
-}
-
-Status ZgwStore::GetPartialObject(ZgwObject* object, int start_byte, int partial_size) {
-  // Assert object has parsed
-
-  std::vector<ZgwObject> candidate_object;
-  Status s;
-  if (object->part_nums().empty()) {
-    // This object
-    int start_strip = start_byte / object->strip_len();
-    start_byte -= start_strip * object->strip_len();
-    int m = (start_byte + partial_size) % object->strip_len();
-    int strip_needed = (start_byte + partial_size) / object->strip_len() + (m > 0 ? 1 : 0);
-    std::string candidate_value, svalue;
-    for (int i = start_strip; i < start_strip + strip_needed; ++i) {
-      s = zp_->Get(kZgwDataTableName, object->DataKey(i), &svalue);
-      if (!s.ok()) {
-        return s;
-      }
-      candidate_value.append(svalue);
-    }
-    object->AppendContent(candidate_value.substr(start_byte, partial_size));
-  } else {
-    for (auto n : object->part_nums()) {
-      // Get sub object size;
-      std::string subobject_name = kInternalSubObjectNamePrefix +
-        std::to_string(n) + kInternalObjectNamePrefix + object->name() + object->upload_id();
-      ZgwObject subobject(object->bucket_name(), subobject_name);
-      s = GetObject(&subobject, false);
-      if (!s.ok()) {
-        return s;
-      }
-      int cur_object_size = subobject.info().size;
-
-      if (start_byte < cur_object_size) {
-        // This subobject
-        int get_size = std::min(cur_object_size - start_byte, partial_size);
-        s = GetPartialObject(&subobject, start_byte, get_size);
-        if (!s.ok()) {
-          return s;
-        }
-        object->AppendContent(subobject.content());
-        partial_size -= get_size;
-        start_byte = 0;
-        if (partial_size == 0) {
-          break;
-        }
-      } else {
-        // Next subobject
-        start_byte -= cur_object_size;
-      }
-    }
+  if (strip_cache() != NULL) {
+    strip_cache()->Erase(object);
   }
-
+  ReclaimStrips(object);
   return Status::OK();
 }
 
 Status ZgwStore::GetPartialObject(ZgwObject* object,
-                                  std::vector<std::pair<int, uint32_t>>& segments) {
+                                  std::vector<std::pair<int64_t, uint64_t>>& segments) {
   // Get Object
   std::string meta_value;
-  Status s = zp_->Get(kZgwMetaTableName, object->MetaKey(), &meta_value);
+  Status s = ZpGet(kZgwMetaTableName, object->MetaKey(), &meta_value);
   if (!s.ok()) {
     return s;
   }
@@ -150,26 +138,20 @@ Status ZgwStore::GetPartialObject(ZgwObject* object,
   }
 
   for (auto &seg : segments) {
-    // Calculate partial size and start byte
-    uint32_t partial_size = 0, start_byte = 0;
-    if (seg.first < 0) {
-      partial_size = 0 - seg.first;
-      partial_size = std::min((uint64_t)partial_size, object->info().size);
-      start_byte = object->info().size - partial_size;
-      seg.first = start_byte;
-      seg.second = start_byte + partial_size - 1;
-    } else {
-      seg.second = std::min((uint64_t)seg.second, object->info().size - 1);
-      partial_size = seg.second - seg.first + 1;
-      start_byte = seg.first;
+    uint64_t offset, length;
+    if (!ResolveByteRange(seg.first, seg.second, object->info().size,
+                          &offset, &length)) {
+      return Status::EndFile("Range is not satisfiable");
     }
+    seg.first = offset;
+    seg.second = offset + length - 1;
 
-    if (start_byte > object->info().size) {
-      return Status::EndFile("Start byte is greater than object size");
+    ZgwObjectReader reader(this, *object, offset, length);
+    std::string cvalue;
+    while ((s = reader.Next(&cvalue)).ok()) {
+      object->ParseNextStrip(&cvalue);
     }
-
-    Status s = GetPartialObject(object, start_byte, partial_size);
-    if (!s.ok()) {
+    if (!s.IsEndFile()) {
       return s;
     }
   }
@@ -189,7 +171,7 @@ Status ZgwStore::ListObjects(const std::string& bucket_name,
     keys.push_back(o.MetaKey());
     objects->push_back(std::move(o));
   }
-  s = zp_->Mget(kZgwMetaTableName, keys, &values);
+  s = ZpMget(kZgwMetaTableName, keys, &values);
   if (!s.ok()) {
     return s;
   }
@@ -207,7 +189,7 @@ Status ZgwStore::ListObjects(const std::string& bucket_name,
 Status ZgwStore::GetObject(ZgwObject* object, bool need_content) {
   // Get Object
   std::string meta_value;
-  Status s = zp_->Get(kZgwMetaTableName, object->MetaKey(), &meta_value);
+  Status s = ZpGet(kZgwMetaTableName, object->MetaKey(), &meta_value);
   if (!s.ok()) {
     return s;
   }
@@ -219,64 +201,64 @@ Status ZgwStore::GetObject(ZgwObject* object, bool need_content) {
   }
 
   if (need_content) {
-    for (auto n : object->part_nums()) {
-      std::string subobject_name = object->name();
-      if (subobject_name.find_first_of(kInternalObjectNamePrefix) != 0) {
-        std::string internal_obname = kInternalObjectNamePrefix +
-          subobject_name + object->upload_id();
-        subobject_name = kInternalSubObjectNamePrefix + std::to_string(n) + internal_obname;
-      }
-      ZgwObject subobject(object->bucket_name(), subobject_name);
-      s = GetObject(&subobject, true);
-      if (!s.ok()) {
-        return s;
-      }
-      object->AppendContent(subobject.content());
-    }
-    // Get Object Data
-    uint32_t index = 0;
+    ZgwObjectReader reader(this, *object);
     std::string cvalue;
-    for (; index < object->strip_count(); index++) {
-      s = zp_->Get(kZgwDataTableName, object->DataKey(index), &cvalue);
-      if (!s.ok()) {
-        return s;
-      }
+    while ((s = reader.Next(&cvalue)).ok()) {
       object->ParseNextStrip(&cvalue);
     }
+    if (!s.IsEndFile()) {
+      return s;
+    }
   }
 
   return Status::OK();
 }
 
-Status ZgwStore::UploadPart(const std::string& bucket_name, const std::string& internal_obname,
-                            const ZgwObjectInfo& info, const std::string& content, int part_num) {
+Status ZgwStore::GetCachedObject(ZgwObject* object) {
+  MetaCache* cache = options_.meta_cache;
+  if (cache == NULL) {
+    return GetObject(object, false);
+  }
+  std::string meta_key = object->MetaKey();
+  if (cache->Lookup(meta_key, object)) {
+    return Status::OK();
+  }
+
+  uint64_t ticket = cache->Ticket(meta_key);
+  std::string meta_value;
+  Status s = ZpGet(kZgwMetaTableName, meta_key, &meta_value);
+  if (!s.ok()) {
+    return s;
+  }
+  uint64_t charge = meta_value.size();
+  s = object->ParseMetaValue(&meta_value);
+  if (!s.ok()) {
+    return s;
+  }
+  cache->Insert(meta_key, ticket, *object, charge);
+  return Status::OK();
+}
+
+Status ZgwStore::UploadPart(const std::string& bucket_name,
+                            const std::string& internal_obname, int part_num) {
   // Get multipart object meta
   ZgwObject object(bucket_name, internal_obname);
   Status s = GetObject(&object, false);
   if (!s.ok()) {
     return s;
   }
-  std::string subobject_name = kInternalSubObjectNamePrefix +
-    std::to_string(part_num) + internal_obname;
 
-  // Check if need override
+  // An overridden part was already replaced by its writer
   auto &part_nums = object.part_nums();
   if (part_nums.find(part_num) != part_nums.end()) {
-    s = DelObject(bucket_name, subobject_name);
-    if (!s.ok()) {
-      return s;
-    }
-  }
-
-  ZgwObject part_object(bucket_name, subobject_name, content, info);
-  s = AddObject(part_object);
-  if (!s.ok()) {
-    return s;
+    return Status::OK();
   }
 
   // Update multipart object meta
   part_nums.insert(part_num);
-  return zp_->Set(kZgwMetaTableName, object.MetaKey(), object.MetaValue());
+  s = ZpSet(kZgwMetaTableName, object.MetaKey(), object.MetaValue());
+  MetaChanged(object.MetaKey());
+  return s;
 }
 
 Status ZgwStore::ListParts(const std::string& bucket_name, const std::string& internal_obname,
@@ -298,7 +280,7 @@ Status ZgwStore::ListParts(const std::string& bucket_name, const std::string& in
     parts->push_back(std::make_pair(n, std::move(subobject)));
   }
 
-  s = zp_->Mget(kZgwMetaTableName, keys, &values);
+  s = ZpMget(kZgwMetaTableName, keys, &values);
   if (!s.ok()) {
     return s;
   }
@@ -319,22 +301,20 @@ Status ZgwStore::CompleteMultiUpload(const std::string& bucket_name,
                                      const std::vector<std::pair<int, ZgwObject>>& parts,
                                      std::string *final_etag) {
   std::string final_object_name = internal_obname.substr(2, internal_obname.size() - 32 - 2);
-  int final_size = 0;
+  uint64_t final_size = 0;
+  std::vector<uint64_t> part_sizes;
   MD5_CTX md5_ctx;
   char buf[33] = {0};
   unsigned char md5[16] = {0};
   MD5_Init(&md5_ctx);
 
-  // Calculate final size and etag
+  // Calculate final size and etag, parts' meta was fetched by ListParts
   Status s;
   for (auto &it : parts) {
-    ZgwObject subob(it.second); // Intend Use Copy
-    s = GetObject(&subob, false);
-    if (!s.ok()) {
-      return s;
-    }
-    final_size += subob.info().size;
-    MD5_Update(&md5_ctx, subob.info().etag.c_str(), subob.info().etag.size());
+    const ZgwObjectInfo& info = it.second.info();
+    final_size += info.size;
+    part_sizes.push_back(info.size);
+    MD5_Update(&md5_ctx, info.etag.c_str(), info.etag.size());
   }
   MD5_Final(md5, &md5_ctx);
   for (int i = 0; i < 16; i++) {
@@ -356,6 +336,24 @@ Status ZgwStore::CompleteMultiUpload(const std::string& bucket_name,
   final_object.info().mtime = now;
   final_object.info().size = final_size;
   final_object.info().etag = *final_etag;
+  // Strip digests of parts are only in their own meta
+  bool parts_by_content = false;
+  for (auto &it : parts) {
+    parts_by_content = parts_by_content || it.second.content_addressed();
+  }
+  if (final_object.part_nums().size() == part_sizes.size() &&
+      !parts_by_content) {
+    final_object.SetPartSizes(part_sizes);
+    // Parts are then found without reading their meta
+    std::vector<uint32_t> strip_lens;
+    std::vector<uint64_t> generations;
+    for (auto &it : parts) {
+      strip_lens.push_back(it.second.strip_len());
+      generations.push_back(it.second.generation());
+    }
+    final_object.SetPartStripLens(strip_lens);
+    final_object.SetPartGenerations(generations);
+  }
 
   // Set new meta
   s = AddObject(final_object);
@@ -363,7 +361,8 @@ Status ZgwStore::CompleteMultiUpload(const std::string& bucket_name,
     return s;
   }
   // Delete old meta
-  s = zp_->Delete(kZgwMetaTableName, cur_object.MetaKey());
+  s = ZpDelete(kZgwMetaTableName, cur_object.MetaKey());
+  MetaChanged(cur_object.MetaKey());
   if (!s.ok() && !s.IsNotFound()) {
     return s;
   }
@@ -7,115 +7,157 @@
 
 namespace libzgw {
 
-Status ZgwStore::BuildMap() {
-  Status s;
-  std::string meta_value;
-  for (auto &name : user_list_.users_name) {
-    ZgwUser *user = new ZgwUser(name);
-    s = zp_->Get(kZgwMetaTableName, user->MetaKey(), &meta_value);
-    if (!s.ok()) {
-      return s;
-    }
-    s = user->ParseMetaValue(&meta_value);
-    if (!s.ok()) {
-      return s;
-    }
+// Unknown access keys remembered by one store, forgotten all at once
+static const size_t kMaxUnknownKeys = 10000;
 
-    for (auto &key_pair : user->access_keys()) {
-      //                    access key
-      access_key_user_map_[key_pair.first] = user;
-    }
-  }
-
-  return Status::OK();
+Status ZgwStore::LoadAllUsers() {
+  std::lock_guard<std::mutex> lock(user_table_->load_mutex);
+  return ReloadUsers();
 }
 
-Status ZgwStore::LoadAllUsers() {
+// Caller holds user_table_->load_mutex
+Status ZgwStore::ReloadUsers() {
   Status s;
   // Load all users
   std::string meta_value;
   int retry = 3;
   do {
-    s = zp_->Get(kZgwMetaTableName, user_list_.MetaKey(), &meta_value);
+    s = ZpGet(kZgwMetaTableName, kUserListKey, &meta_value);
     if (s.ok()) {
       break;
     }
   } while (retry--);
 
-  if (!s.ok() && !s.IsNotFound()) {
+  if (s.IsNotFound()) {
+    // Empty user list
+    meta_value.clear();
+  } else if (!s.ok()) {
     return s;
   }
 
-  if (!meta_value.empty() &&
-      user_list_.ParseMetaValue(&meta_value).ok()) {
-    return BuildMap();
+  std::shared_ptr<const ZgwUserSnapshot> current = user_table_->snapshot();
+  if (current && current->list_value == meta_value) {
+    return Status::OK();
+  }
+
+  // User list changed, build a new snapshot
+  std::shared_ptr<ZgwUserSnapshot> snapshot = std::make_shared<ZgwUserSnapshot>();
+  snapshot->list_value = meta_value;
+  ZgwUserList user_list;
+  if (!meta_value.empty()) {
+    s = user_list.ParseMetaValue(&meta_value);
+    if (!s.ok()) {
+      return s;
+    }
+  }
+  std::string user_value;
+  for (auto &name : user_list.users_name) {
+    std::unique_ptr<ZgwUser> user(new ZgwUser(name));
+    s = ZpGet(kZgwMetaTableName, user->MetaKey(), &user_value);
+    if (!s.ok()) {
+      return s;
+    }
+    s = user->ParseMetaValue(&user_value);
+    if (!s.ok()) {
+      return s;
+    }
+
+    for (auto &key_pair : user->access_keys()) {
+      //                                 access key
+      snapshot->access_key_user_map[key_pair.first] = user.get();
+    }
+    snapshot->users.push_back(std::move(user));
   }
-  // Empty user list
+
+  user_table_->Publish(snapshot);
   return Status::OK();
 }
+
+const ZgwUserSnapshot* ZgwStore::RefreshUsers() {
+  if (!users_ || users_->generation != user_table_->generation()) {
+    users_ = user_table_->snapshot();
+    if (!users_) {
+      // Nothing published yet
+      users_ = std::make_shared<ZgwUserSnapshot>();
+    }
+  }
+  return users_.get();
+}
  
 Status ZgwStore::AddUser(const std::string &user_name,
                          std::string *access_key,
                          std::string *secret_key) {
+  std::lock_guard<std::mutex> lock(user_table_->load_mutex);
+  Status s = ReloadUsers();
+  if (!s.ok()) {
+    return s;
+  }
+
+  ZgwUserList user_list;
+  std::shared_ptr<const ZgwUserSnapshot> current = user_table_->snapshot();
+  if (current && !current->list_value.empty()) {
+    std::string list_value = current->list_value;
+    s = user_list.ParseMetaValue(&list_value);
+    if (!s.ok()) {
+      return s;
+    }
+  }
   // Return if user exists
-  if (user_list_.users_name.find(user_name) !=
-      user_list_.users_name.end()) {
+  if (user_list.users_name.find(user_name) !=
+      user_list.users_name.end()) {
     return Status::Corruption("User already created");
   }
 
   // Create user
-  ZgwUser *user = new ZgwUser(user_name);
-  Status s = user->GenKeyPair(access_key, secret_key);
+  ZgwUser user(user_name);
+  s = user.GenKeyPair(access_key, secret_key);
   if (!s.ok()) {
     return s;
   }
 
   // Dump user to zeppelin
-  s = zp_->Set(kZgwMetaTableName, user->MetaKey(), user->MetaValue());
+  s = ZpSet(kZgwMetaTableName, user.MetaKey(), user.MetaValue());
   if (!s.ok()) {
     return s;
   }
-  
-  // Dump user to zeppelin
-  s = zp_->Set(kZgwMetaTableName, user->MetaKey(), user->MetaValue());
-  if (!s.ok()) {
-    return s;
-  }
-
-  // Insert into memory
-  access_key_user_map_[*access_key] = user;
-  user_list_.users_name.insert(user_name);
 
   // Dump list to zeppelin
-  s = zp_->Set(kZgwMetaTableName, user_list_.MetaKey(), user_list_.MetaValue());
+  user_list.users_name.insert(user_name);
+  s = ZpSet(kZgwMetaTableName, user_list.MetaKey(), user_list.MetaValue());
   if (!s.ok()) {
-    user_list_.users_name.erase(user_name);
-    access_key_user_map_.erase(*access_key);
     return s;
   }
 
-  return s;
+  // Publish to all workers
+  return ReloadUsers();
 }
 
 Status ZgwStore::GetUser(const std::string &access_key, ZgwUser **user) {
   assert(user);
-  int times = 0;
-retry:
-  bool found = (access_key_user_map_.find(access_key) !=
-                access_key_user_map_.end());
-
-  if (!found) {
-    if (times == 0) {
-      ++times;
+  const ZgwUserSnapshot* users = RefreshUsers();
+  *user = users->Find(access_key);
+  if (*user != NULL) {
+    return Status::OK();
+  }
+
+  auto it = unknown_keys_.find(access_key);
+  if (it == unknown_keys_.end() || it->second != users->generation) {
+    // Maybe just added through another gateway, reload unless some
+    // worker did it lately
+    if (user_table_->ShouldReloadOnMiss()) {
       LoadAllUsers();
-      goto retry;
-    } else {
-      return Status::AuthFailed("Can not recognize this access key");
+      users = RefreshUsers();
+      *user = users->Find(access_key);
+      if (*user != NULL) {
+        return Status::OK();
+      }
+    }
+    if (unknown_keys_.size() >= kMaxUnknownKeys) {
+      unknown_keys_.clear();
     }
+    unknown_keys_[access_key] = users->generation;
   }
-
-  *user = access_key_user_map_[access_key];
-  return Status::OK();
+  return Status::AuthFailed("Can not recognize this access key");
 }
 
 // Use std::set avoid repeated user
@@ -124,8 +166,13 @@ Status ZgwStore::ListUsers(std::set<ZgwUser *> *user_list) {
   if (!s.ok()) {
     return s;
   }
-  for (auto &item : access_key_user_map_) {
-    user_list->insert(item.second);
+  // Kept apart from users_, so users got by GetUser stay valid
+  listed_users_ = user_table_->snapshot();
+  if (!listed_users_) {
+    return Status::OK();
+  }
+  for (auto &user : listed_users_->users) {
+    user_list->insert(user.get());
   }
 
   return Status::OK();
@@ -0,0 +1,352 @@
+#include "src/libzgw/zgw_stream.h"
+
+#include <algorithm>
+
+#include <openssl/sha.h>
+
+#include "src/libzgw/zgw_store.h"
+
+namespace libzgw {
+
+ZgwObjectWriter::ZgwObjectWriter(ZgwStore* store, const std::string& bucket_name,
+                                 const std::string& name, const ZgwObjectInfo& info,
+                                 uint64_t size_hint)
+      : store_(store),
+        object_(bucket_name, name),
+        strip_index_(0),
+        size_(0),
+        finished_(false),
+        committed_(false),
+        new_object_(false),
+        old_meta_requested_(false) {
+  object_.SetObjectInfo(info);
+  object_.SetStripLen(store_->StripLenFor(size_hint));
+  if (store_->content_addressed()) {
+    object_.SetContentAddressed();
+  } else {
+    // The live object, if any, is left alone until the new meta is set
+    object_.SetGeneration(ZgwObject::NewGeneration());
+  }
+  // Parts are found by their size alone, see ZgwObject::PartObject
+  inline_ok_ = store_->inline_max_size() > 0 &&
+    name.compare(0, kInternalSubObjectNamePrefix.size(),
+                 kInternalSubObjectNamePrefix) != 0;
+  if (inline_ok_ && size_hint <= store_->inline_max_size() &&
+      object_.strip_len() < store_->inline_max_size()) {
+    // Keep it all in strip_buf_ until Finish
+    object_.SetStripLen(store_->inline_max_size());
+  }
+  MD5_Init(&md5_ctx_);
+}
+
+ZgwObjectWriter::~ZgwObjectWriter() {
+  if (!committed_) {
+    Discard();
+  }
+}
+
+void ZgwObjectWriter::Discard() {
+  WaitInflight(0);
+  if (strip_index_ == 0) {
+    return;
+  }
+  if (!object_.content_addressed()) {
+    // Failed Sets are reclaimed too, they may have been stored anyway
+    ZgwObject written(object_);
+    written.SetStripCount(strip_index_);
+    store_->ReclaimStrips(written);
+    return;
+  }
+  // Those not taken belong to other objects
+  std::vector<std::string> keys;
+  for (uint32_t i = 0; i < strip_index_; i++) {
+    if (std::find(failed_refs_.begin(), failed_refs_.end(), i) ==
+        failed_refs_.end()) {
+      keys.push_back(object_.DataKey(i));
+    }
+  }
+  store_->ReclaimKeys(&keys);
+}
+
+void ZgwObjectWriter::RequestOldMeta() {
+  if (!new_object_ && !old_meta_requested_) {
+    old_meta_requested_ = true;
+    old_meta_ = store_->AsyncGet(kZgwMetaTableName, object_.MetaKey());
+  }
+}
+
+Status ZgwObjectWriter::Append(const char* data, size_t size) {
+  assert(!finished_);
+  RequestOldMeta();
+  MD5_Update(&md5_ctx_, data, size);
+  size_ += size;
+
+  Status s;
+  uint32_t strip_len = object_.strip_len();
+  while (size > 0) {
+    size_t clen = std::min(size, static_cast<size_t>(strip_len - strip_buf_.size()));
+    strip_buf_.append(data, clen);
+    data += clen;
+    size -= clen;
+    if (strip_buf_.size() == strip_len) {
+      s = FlushStrip();
+      if (!s.ok()) {
+        return s;
+      }
+    }
+  }
+  return Status::OK();
+}
+
+Status ZgwObjectWriter::FlushStrip() {
+  if (object_.content_addressed()) {
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    SHA256(reinterpret_cast<const unsigned char*>(strip_buf_.data()),
+           strip_buf_.size(), digest);
+    object_.AddStripDigest(reinterpret_cast<const char*>(digest));
+    inflight_.push_back(std::make_pair(strip_index_, store_->AsyncPutContentStrip(
+                object_.DataKey(strip_index_), std::move(strip_buf_))));
+  } else {
+    inflight_.push_back(std::make_pair(strip_index_, store_->AsyncSetStrip(
+                object_.DataKey(strip_index_), std::move(strip_buf_))));
+  }
+  strip_index_++;
+  strip_buf_.clear();
+  return WaitInflight(store_->strip_window() - 1);
+}
+
+Status ZgwObjectWriter::WaitInflight(size_t max_inflight) {
+  Status s;
+  while (inflight_.size() > max_inflight) {
+    StripResult res = store_->WaitStrip(&inflight_.front().second);
+    if (!res.status.ok() && object_.content_addressed()) {
+      failed_refs_.push_back(inflight_.front().first);
+    }
+    inflight_.pop_front();
+    if (!res.status.ok() && s.ok()) {
+      s = res.status;
+    }
+  }
+  return s;
+}
+
+Status ZgwObjectWriter::Finish() {
+  assert(!finished_);
+  finished_ = true;
+  Status s;
+  if (inline_ok_ && strip_index_ == 0 &&
+      size_ <= store_->inline_max_size()) {
+    object_.SetInlineData(&strip_buf_);
+  } else if (!strip_buf_.empty()) {
+    s = FlushStrip();
+    if (!s.ok()) {
+      return s;
+    }
+  }
+  s = WaitInflight(0);
+  if (!s.ok()) {
+    return s;
+  }
+
+  if (linked_etag_.empty()) {
+    char buf[33] = {0};
+    unsigned char md5[16] = {0};
+    MD5_Final(md5, &md5_ctx_);
+    for (int i = 0; i < 16; i++) {
+      sprintf(buf + i * 2, "%02x", md5[i]);
+    }
+    object_.info().etag.assign("\"" + std::string(buf) + "\"");
+  } else {
+    object_.info().etag = linked_etag_;
+  }
+  object_.info().size = size_;
+  object_.SetStripCount(strip_index_);
+
+  // A failed Set may still have been applied, strips are kept from here
+  committed_ = true;
+  if (new_object_) {
+    return store_->SetObjectMeta(object_, NULL);
+  }
+  RequestOldMeta();
+  StripResult old_meta = store_->WaitStrip(&old_meta_, kZgwMetaTableName);
+  ZgwObject old_object(object_.bucket_name(), object_.name());
+  bool has_old = old_meta.status.ok() &&
+    old_object.ParseMetaValue(&old_meta.value).ok();
+  return store_->SetObjectMeta(object_, has_old ? &old_object : NULL);
+}
+
+Status ZgwObjectWriter::Link(const ZgwObject& src) {
+  assert(!finished_ && size_ == 0 && strip_index_ == 0);
+  if (!src.content_addressed() || !src.part_nums().empty()) {
+    return Status::NotSupported("Source strips are not shared");
+  }
+  RequestOldMeta();
+
+  // References taken are dropped again if any fails
+  Status s;
+  uint32_t next = 0;
+  std::vector<uint32_t> taken;
+  std::deque<std::pair<uint32_t, std::future<StripResult>>> pending;
+  while ((next < src.strip_count() && s.ok()) || !pending.empty()) {
+    while (next < src.strip_count() && s.ok() &&
+           pending.size() < store_->strip_window()) {
+      pending.push_back(std::make_pair(
+              next, store_->AsyncRefContentStrip(src.DataKey(next))));
+      next++;
+    }
+    StripResult res = store_->WaitStrip(&pending.front().second,
+                                        kZgwMetaTableName);
+    if (res.status.ok()) {
+      taken.push_back(pending.front().first);
+    } else if (s.ok()) {
+      s = res.status;
+    }
+    pending.pop_front();
+  }
+  if (!s.ok()) {
+    for (uint32_t i : taken) {
+      store_->DropStrip(src.DataKey(i));
+    }
+    return s;
+  }
+
+  object_.SetContentAddressed();
+  object_.SetGeneration(0);
+  object_.SetStripLen(src.strip_len());
+  object_.SetStripDigests(src.strip_digests());
+  strip_index_ = src.strip_count();
+  size_ = src.info().size;
+  linked_etag_ = src.info().etag;
+  inline_ok_ = false;
+  return Status::OK();
+}
+
+ZgwObjectReader::ZgwObjectReader(ZgwStore* store, const ZgwObject& object,
+                                 uint64_t offset, uint64_t size)
+      : store_(store),
+        object_(object),
+        parts_(object.part_nums().begin(), object.part_nums().end()),
+        next_part_(0),
+        cur_(object.bucket_name(), ""),
+        cur_strip_(0),
+        cur_end_strip_(0),
+        own_strips_done_(false),
+        skip_(offset),
+        left_(size) {
+}
+
+Status ZgwObjectReader::NextObject() {
+  Status s;
+  if (next_part_ < parts_.size()) {
+    // Sub objects of a multipart object come first
+    if (object_.has_part_sizes()) {
+      cur_ = object_.PartObject(next_part_++);
+    } else {
+      cur_ = ZgwObject(object_.bucket_name(),
+                       SubObjectName(object_.InternalName(), parts_[next_part_++]));
+      s = store_->GetObject(&cur_, false);
+    }
+  } else if (!own_strips_done_) {
+    own_strips_done_ = true;
+    cur_ = object_;
+  } else {
+    return Status::EndFile("No more strips");
+  }
+
+  // Only the strips of cur_ overlapping the range are read
+  cur_strip_ = 0;
+  cur_end_strip_ = 0;
+  uint64_t size = cur_.strip_count() > 0 ? cur_.info().size : 0;
+  if (!s.ok() || cur_.is_inline()) {
+    return s;
+  } else if (skip_ >= size) {
+    skip_ -= size;
+    return s;
+  }
+  uint64_t end = left_ < size - skip_ ? skip_ + left_ : size;
+  cur_strip_ = skip_ / cur_.strip_len();
+  cur_end_strip_ = std::min(
+      static_cast<uint64_t>(cur_.strip_count()),
+      (end + cur_.strip_len() - 1) / cur_.strip_len());
+  skip_ -= static_cast<uint64_t>(cur_strip_) * cur_.strip_len();
+  return s;
+}
+
+void ZgwObjectReader::Prefetch() {
+  while (pending_.size() < store_->strip_window() &&
+         cur_strip_ < cur_end_strip_) {
+    std::string data_key = cur_.DataKey(cur_strip_++);
+    StripCache* cache = store_->strip_cache();
+    if (cache == NULL) {
+      pending_.push_back(std::make_pair(std::string(),
+                                        store_->AsyncGetStrip(data_key)));
+      continue;
+    }
+    // Parts are cached under the version of the whole object
+    std::string cache_key = StripCache::Key(object_, data_key);
+    std::promise<StripResult> hit;
+    StripResult res;
+    if (cache->Lookup(cache_key, &res.value)) {
+      hit.set_value(std::move(res));
+      pending_.push_back(std::make_pair(std::string(), hit.get_future()));
+    } else {
+      pending_.push_back(std::make_pair(std::move(cache_key),
+                                        store_->AsyncGetStrip(data_key)));
+    }
+  }
+}
+
+void ZgwObjectReader::Trim(std::string* data) {
+  if (skip_ > 0) {
+    data->erase(0, std::min(skip_, static_cast<uint64_t>(data->size())));
+    skip_ = 0;
+  }
+  if (data->size() > left_) {
+    data->resize(left_);
+  }
+  left_ -= data->size();
+}
+
+Status ZgwObjectReader::Next(std::string* strip) {
+  Status s;
+  while (pending_.empty()) {
+    if (left_ == 0) {
+      return Status::EndFile("End of range");
+    }
+    if (cur_strip_ >= cur_end_strip_) {
+      s = NextObject();
+      if (!s.ok()) {
+        return s;
+      }
+      if (cur_.is_inline()) {
+        const std::string& data = cur_.inline_data();
+        if (skip_ >= data.size()) {
+          skip_ -= data.size();
+          continue;
+        }
+        strip->assign(data);
+        Trim(strip);
+        return Status::OK();
+      }
+    }
+    Prefetch();
+  }
+
+  std::string cache_key = std::move(pending_.front().first);
+  std::future<StripResult> front = std::move(pending_.front().second);
+  pending_.pop_front();
+  // Keep the following strips in flight while waiting for this one
+  Prefetch();
+  StripResult res = store_->WaitStrip(&front);
+  if (!res.status.ok()) {
+    return res.status;
+  }
+  if (!cache_key.empty()) {
+    store_->strip_cache()->Insert(cache_key, res.value);
+  }
+  Trim(&res.value);
+  strip->swap(res.value);
+  return Status::OK();
+}
+
+}  // namespace libzgw
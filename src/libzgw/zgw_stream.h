@@ -0,0 +1,141 @@
+#ifndef ZGW_STREAM_H
+#define ZGW_STREAM_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <future>
+
+#include <openssl/md5.h>
+#include "slash/include/slash_status.h"
+#include "src/libzgw/zgw_object.h"
+#include "src/libzgw/zgw_strip_pool.h"
+
+namespace libzgw {
+
+using slash::Status;
+
+class ZgwStore;
+
+// Write one object to zeppelin strip by strip as its body arrives,
+// at most strip window strips plus the unfinished tail are in memory.
+// Strips go to keys of their own and the meta is set last, so the object
+// being replaced stays whole until then. Strips of a writer destroyed
+// before Finish sets the meta are reclaimed
+class ZgwObjectWriter {
+ public:
+  // The strip length is picked by the store's policy for size_hint, the
+  // expected object size. Objects small enough are kept in their meta
+  // value instead
+  ZgwObjectWriter(ZgwStore* store, const std::string& bucket_name,
+                  const std::string& name, const ZgwObjectInfo& info,
+                  uint64_t size_hint);
+  ~ZgwObjectWriter();
+
+  Status Append(const char* data, size_t size);
+  Status Append(const std::string& data) {
+    return Append(data.data(), data.size());
+  }
+
+  // Write the tail strip and the object meta, etag and size in
+  // object().info() are valid after this returns ok
+  Status Finish();
+
+  // Reference the strips of src, stored by content, instead of copying
+  // its data. Only before anything is appended, NotSupported if src
+  // strips are not shared
+  Status Link(const ZgwObject& src);
+
+  // The object name is known to be unused, before the first Append.
+  // Otherwise the old meta is read alongside the strip writes and its
+  // stale strips are reclaimed
+  void SetNewObject() {
+    new_object_ = true;
+  }
+
+  const ZgwObject& object() const {
+    return object_;
+  }
+
+  uint64_t size() const {
+    return size_;
+  }
+
+ private:
+  ZgwStore* store_;
+  ZgwObject object_;
+  std::string strip_buf_;
+  uint32_t strip_index_;
+  uint64_t size_;
+  bool inline_ok_;
+  MD5_CTX md5_ctx_;
+  // etag of the object linked, if any
+  std::string linked_etag_;
+  bool finished_;
+  // The meta was set, or may have been
+  bool committed_;
+  bool new_object_;
+  bool old_meta_requested_;
+  std::future<StripResult> old_meta_;
+  // Strip index : its Set, or its reference for strips stored by content
+  std::deque<std::pair<uint32_t, std::future<StripResult>>> inflight_;
+  // Strips stored by content whose reference was not taken
+  std::vector<uint32_t> failed_refs_;
+
+  void RequestOldMeta();
+  // Reclaim the strips written so far and drop the references taken,
+  // nothing refers to them
+  void Discard();
+  Status FlushStrip();
+  Status WaitInflight(size_t max_inflight);
+
+  // No copying allowed
+  ZgwObjectWriter(const ZgwObjectWriter&);
+  void operator=(const ZgwObjectWriter&);
+};
+
+// Read one object from zeppelin strip by strip, multipart objects are
+// walked part after part without loading the whole object
+class ZgwObjectReader {
+ public:
+  // object's meta must have been parsed, e.g. by GetObject(object, false).
+  // Only size bytes from offset on are read, strips before them are
+  // skipped without reading
+  ZgwObjectReader(ZgwStore* store, const ZgwObject& object,
+                  uint64_t offset = 0, uint64_t size = UINT64_MAX);
+  ~ZgwObjectReader() {}
+
+  // Return EndFile once all strips have been read
+  Status Next(std::string* strip);
+
+ private:
+  ZgwStore* store_;
+  ZgwObject object_;
+  std::vector<int> parts_;
+  size_t next_part_;
+  ZgwObject cur_;
+  uint32_t cur_strip_;
+  uint32_t cur_end_strip_;
+  bool own_strips_done_;
+  // Bytes still to skip before the range, and left in it
+  uint64_t skip_;
+  uint64_t left_;
+  // Strips of cur_ requested ahead of the caller, with the strip cache
+  // key to fill once read, empty if served by the cache
+  std::deque<std::pair<std::string, std::future<StripResult>>> pending_;
+
+  // Step cur_ to the next object holding strips
+  Status NextObject();
+  void Prefetch();
+  // Cut data, the next piece of the object, to the range
+  void Trim(std::string* data);
+
+  // No copying allowed
+  ZgwObjectReader(const ZgwObjectReader&);
+  void operator=(const ZgwObjectReader&);
+};
+
+}  // namespace libzgw
+
+#endif  // ZGW_STREAM_H
@@ -0,0 +1,191 @@
+#include "src/libzgw/zgw_strip_cache.h"
+
+#include <algorithm>
+#include <functional>
+
+#include "src/libzgw/zgw_object.h"
+
+namespace libzgw {
+
+static const uint64_t kSketchSeeds[4] = {
+  0xc3a5c85c97cb3127ULL, 0xb492b66fbe98f273ULL,
+  0x9ae16a3b2f90404fULL, 0xcbf29ce484222325ULL
+};
+static const uint8_t kMaxFrequency = 15;
+
+StripCache::FrequencySketch::FrequencySketch(size_t width)
+      : additions_(0) {
+  size_t w = 1;
+  while (w < width) {
+    w <<= 1;
+  }
+  counters_.assign(w * 4, 0);
+  mask_ = w - 1;
+  sample_size_ = w * 10;
+}
+
+size_t StripCache::FrequencySketch::Index(uint64_t hash, int row) const {
+  uint64_t h = (hash + kSketchSeeds[row]) * 0x9e3779b97f4a7c15ULL;
+  h ^= h >> 32;
+  return row * (mask_ + 1) + (h & mask_);
+}
+
+void StripCache::FrequencySketch::Increment(uint64_t hash) {
+  bool added = false;
+  for (int row = 0; row < 4; row++) {
+    uint8_t& c = counters_[Index(hash, row)];
+    if (c < kMaxFrequency) {
+      c++;
+      added = true;
+    }
+  }
+  if (added && ++additions_ >= sample_size_) {
+    // Age all counts
+    for (auto& c : counters_) {
+      c >>= 1;
+    }
+    additions_ /= 2;
+  }
+}
+
+uint32_t StripCache::FrequencySketch::Estimate(uint64_t hash) const {
+  uint32_t freq = kMaxFrequency;
+  for (int row = 0; row < 4; row++) {
+    freq = std::min<uint32_t>(freq, counters_[Index(hash, row)]);
+  }
+  return freq;
+}
+
+StripCache::StripCache(uint64_t capacity_bytes)
+      : shard_capacity_(capacity_bytes / kStripCacheShards) {
+  // About one counter per 16KB strip the shard can hold
+  size_t width = std::max<uint64_t>(256, std::min<uint64_t>(
+          1 << 20, shard_capacity_ >> 14));
+  for (auto& shard : shards_) {
+    shard.bytes = 0;
+    shard.sketch.reset(new FrequencySketch(width));
+  }
+}
+
+std::string StripCache::Key(const ZgwObject& object,
+                            const std::string& data_key) {
+  if (data_key.compare(0, kContentStripPrefix.size(), kContentStripPrefix) == 0) {
+    return data_key;
+  }
+  const ZgwObjectInfo& info = object.info();
+  return data_key + '\0' + info.etag + '\0' +
+    std::to_string(info.mtime.tv_sec) + '.' + std::to_string(info.mtime.tv_usec);
+}
+
+StripCache::Shard* StripCache::FindShard(const std::string& key,
+                                         uint64_t* hash) {
+  *hash = std::hash<std::string>()(key);
+  return &shards_[*hash % kStripCacheShards];
+}
+
+bool StripCache::Lookup(const std::string& key, std::string* value) {
+  uint64_t hash;
+  Shard* shard = FindShard(key, &hash);
+  std::shared_ptr<const std::string> v;
+  {
+    std::lock_guard<std::mutex> lock(shard->mu);
+    shard->sketch->Increment(hash);
+    auto it = shard->index.find(key);
+    if (it == shard->index.end()) {
+      shard->stats.misses++;
+      return false;
+    }
+    shard->stats.hits++;
+    shard->lru.splice(shard->lru.begin(), shard->lru, it->second);
+    v = it->second->value;
+  }
+  // Strips are copied out of the lock
+  value->assign(*v);
+  return true;
+}
+
+void StripCache::Insert(const std::string& key, const std::string& value) {
+  Entry entry;
+  entry.key = key;
+  entry.value = std::make_shared<const std::string>(value);
+  uint64_t charge = Charge(entry);
+  Shard* shard = FindShard(key, &entry.hash);
+  uint64_t hash = entry.hash;
+  if (charge > shard_capacity_ / 4) {
+    return;
+  }
+
+  // Evicted strips are freed out of the lock
+  std::vector<std::shared_ptr<const std::string>> evicted;
+  std::lock_guard<std::mutex> lock(shard->mu);
+  if (shard->index.find(key) != shard->index.end()) {
+    return;
+  }
+  uint32_t freq = shard->sketch->Estimate(hash);
+  while (shard->bytes + charge > shard_capacity_) {
+    Entry& victim = shard->lru.back();
+    if (freq <= shard->sketch->Estimate(victim.hash)) {
+      shard->stats.rejects++;
+      return;
+    }
+    shard->bytes -= Charge(victim);
+    shard->index.erase(victim.key);
+    evicted.push_back(std::move(victim.value));
+    shard->lru.pop_back();
+    shard->stats.evictions++;
+  }
+  shard->lru.push_front(std::move(entry));
+  shard->index[key] = shard->lru.begin();
+  shard->bytes += charge;
+  shard->stats.inserts++;
+}
+
+void StripCache::EraseKey(const std::string& key) {
+  uint64_t hash;
+  Shard* shard = FindShard(key, &hash);
+  std::shared_ptr<const std::string> v;
+  std::lock_guard<std::mutex> lock(shard->mu);
+  auto it = shard->index.find(key);
+  if (it == shard->index.end()) {
+    return;
+  }
+  shard->bytes -= Charge(*it->second);
+  v = std::move(it->second->value);
+  shard->lru.erase(it->second);
+  shard->index.erase(it);
+}
+
+void StripCache::Erase(const ZgwObject& object) {
+  if (object.content_addressed()) {
+    // Shared strips stay valid for other objects
+    return;
+  }
+  if (object.has_part_sizes()) {
+    for (size_t i = 0; i < object.part_count(); i++) {
+      ZgwObject part = object.PartObject(i);
+      for (uint32_t n = 0; n < part.strip_count(); n++) {
+        EraseKey(Key(object, part.DataKey(n)));
+      }
+    }
+  }
+  // Parts of older multipart objects are left to age out
+  for (uint32_t n = 0; n < object.strip_count(); n++) {
+    EraseKey(Key(object, object.DataKey(n)));
+  }
+}
+
+void StripCache::GetStats(StripCacheStats* stats) {
+  *stats = StripCacheStats();
+  for (auto& shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.mu);
+    stats->hits += shard.stats.hits;
+    stats->misses += shard.stats.misses;
+    stats->inserts += shard.stats.inserts;
+    stats->rejects += shard.stats.rejects;
+    stats->evictions += shard.stats.evictions;
+    stats->resident += shard.index.size();
+    stats->resident_bytes += shard.bytes;
+  }
+}
+
+}  // namespace libzgw
@@ -0,0 +1,105 @@
+#ifndef ZGW_STRIP_CACHE_H
+#define ZGW_STRIP_CACHE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <list>
+#include <mutex>
+#include <memory>
+#include <unordered_map>
+
+namespace libzgw {
+
+class ZgwObject;
+
+struct StripCacheStats {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t inserts;
+  // Strips turned away by admission
+  uint64_t rejects;
+  uint64_t evictions;
+  uint64_t resident;
+  uint64_t resident_bytes;
+
+  StripCacheStats()
+      : hits(0), misses(0), inserts(0), rejects(0), evictions(0),
+        resident(0), resident_bytes(0) {
+  }
+};
+
+static const size_t kStripCacheShards = 16;
+
+// Strips recently read, shared by the stores of all workers. A strip only
+// goes in if it was asked for more often than the one it would evict, as
+// estimated by a TinyLFU sketch, so a single pass over a large object
+// does not push the hot strips out
+class StripCache {
+ public:
+  explicit StripCache(uint64_t capacity_bytes);
+
+  // Key of the strip at data_key, read for object. Strips of objects
+  // stored before generations were overwritten in place, so the key
+  // carries object's etag and mtime: strips of an object replaced by any
+  // gateway are not hit again. Strips stored by content never change
+  static std::string Key(const ZgwObject& object, const std::string& data_key);
+
+  bool Lookup(const std::string& key, std::string* value);
+  void Insert(const std::string& key, const std::string& value);
+  // Drop the strips read for object, once it is replaced or deleted here
+  void Erase(const ZgwObject& object);
+
+  void GetStats(StripCacheStats* stats);
+
+ private:
+  // Count-min sketch of 4 rows of saturating counters, halved once
+  // enough increments were taken, so the counts follow recent traffic
+  class FrequencySketch {
+   public:
+    explicit FrequencySketch(size_t width);
+    void Increment(uint64_t hash);
+    uint32_t Estimate(uint64_t hash) const;
+
+   private:
+    std::vector<uint8_t> counters_;
+    size_t mask_;
+    uint64_t additions_;
+    uint64_t sample_size_;
+
+    size_t Index(uint64_t hash, int row) const;
+  };
+
+  struct Entry {
+    std::string key;
+    uint64_t hash;
+    std::shared_ptr<const std::string> value;
+  };
+
+  struct Shard {
+    std::mutex mu;
+    // Most recently used first
+    std::list<Entry> lru;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    uint64_t bytes;
+    std::unique_ptr<FrequencySketch> sketch;
+    StripCacheStats stats;
+  };
+
+  uint64_t shard_capacity_;
+  Shard shards_[kStripCacheShards];
+
+  Shard* FindShard(const std::string& key, uint64_t* hash);
+  void EraseKey(const std::string& key);
+  static uint64_t Charge(const Entry& entry) {
+    return entry.key.size() + entry.value->size() + 64;
+  }
+
+  // No copying allowed
+  StripCache(const StripCache&);
+  void operator=(const StripCache&);
+};
+
+}  // namespace libzgw
+
+#endif  // ZGW_STRIP_CACHE_H
@@ -0,0 +1,68 @@
+#include "src/libzgw/zgw_strip_gc.h"
+
+#include <iterator>
+
+#include "src/libzgw/zgw_store.h"
+
+namespace libzgw {
+
+StripGc::StripGc()
+      : store_(NULL),
+        should_exit_(false),
+        deleted_(0) {
+}
+
+StripGc::~StripGc() {
+  Stop();
+}
+
+void StripGc::Start(ZgwStore* store) {
+  store_ = store;
+  should_exit_ = false;
+  thread_ = std::thread(&StripGc::ThreadMain, this);
+}
+
+void StripGc::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    should_exit_ = true;
+  }
+  cv_.notify_one();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+bool StripGc::Add(std::vector<std::string>* keys) {
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (keys_.size() + keys->size() > kMaxStripGcKeys) {
+      return false;
+    }
+    keys_.insert(keys_.end(), std::make_move_iterator(keys->begin()),
+                 std::make_move_iterator(keys->end()));
+  }
+  keys->clear();
+  cv_.notify_one();
+  return true;
+}
+
+void StripGc::ThreadMain() {
+  std::string key;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mu_);
+      cv_.wait(lock, [this] { return should_exit_ || !keys_.empty(); });
+      if (keys_.empty()) {
+        return;
+      }
+      key.swap(keys_.front());
+      keys_.pop_front();
+    }
+    // Strips are never read again, a failed delete only leaks them
+    store_->DropStrip(key);
+    deleted_.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+}  // namespace libzgw
@@ -0,0 +1,62 @@
+#ifndef ZGW_STRIP_GC_H
+#define ZGW_STRIP_GC_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+namespace libzgw {
+
+class ZgwStore;
+
+// Keys queued before the callers delete strips themselves
+static const size_t kMaxStripGcKeys = 1 << 20;
+
+// Deletes the strips left behind by overwritten and deleted objects on
+// one background thread, off the request path. Strips stored by content
+// lose one reference instead. Only keys no later write can store again
+// may be queued, see ZgwObject::generation
+class StripGc {
+ public:
+  StripGc();
+  ~StripGc();
+
+  // store is used by the gc thread only
+  void Start(ZgwStore* store);
+  // Delete what is queued and stop
+  void Stop();
+
+  // Data keys are taken if true, false if the queue is full
+  bool Add(std::vector<std::string>* keys);
+
+  uint64_t queued() {
+    std::lock_guard<std::mutex> lock(mu_);
+    return keys_.size();
+  }
+  uint64_t deleted() const {
+    return deleted_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  ZgwStore* store_;
+  std::thread thread_;
+  std::mutex mu_;
+  std::condition_variable cv_;
+  std::deque<std::string> keys_;
+  bool should_exit_;
+  std::atomic<uint64_t> deleted_;
+
+  void ThreadMain();
+
+  // No copying allowed
+  StripGc(const StripGc&);
+  void operator=(const StripGc&);
+};
+
+}  // namespace libzgw
+
+#endif  // ZGW_STRIP_GC_H
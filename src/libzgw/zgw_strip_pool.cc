@@ -0,0 +1,94 @@
+#include "src/libzgw/zgw_strip_pool.h"
+
+#include <utility>
+
+#include "slash/include/env.h"
+
+namespace libzgw {
+
+StripPool::StripPool(const std::vector<ZgwBackend*>& backends)
+      : backends_(backends),
+        should_exit_(false) {
+  for (auto backend : backends_) {
+    threads_.push_back(std::thread(&StripPool::ThreadMain, this, backend));
+  }
+}
+
+StripPool::~StripPool() {
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    should_exit_ = true;
+  }
+  cv_.notify_all();
+  for (auto& t : threads_) {
+    t.join();
+  }
+  for (auto b : backends_) {
+    delete b;
+  }
+}
+
+std::future<StripResult> StripPool::Schedule(
+    std::function<StripResult(ZgwBackend*)> func) {
+  Task task(std::move(func));
+  std::future<StripResult> result = task.get_future();
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    tasks_.push_back(std::move(task));
+  }
+  cv_.notify_one();
+  return result;
+}
+
+std::future<StripResult> StripPool::Set(const std::string& table,
+                                        const std::string& key,
+                                        std::string value) {
+  // The value is moved into the task, the caller's buffer is free to reuse
+  auto shared_value = std::make_shared<std::string>(std::move(value));
+  return Schedule([table, key, shared_value](ZgwBackend* backend) {
+    StripResult res;
+    res.span.op = ZgwSpan::kSet;
+    res.span.start_us = slash::NowMicros();
+    res.status = backend->Set(table, key, *shared_value);
+    res.span.micros = slash::NowMicros() - res.span.start_us;
+    res.span.key = key;
+    res.span.key_size = key.size();
+    res.span.value_size = shared_value->size();
+    res.span.ok = res.status.ok();
+    return res;
+  });
+}
+
+std::future<StripResult> StripPool::Get(const std::string& table,
+                                        const std::string& key) {
+  return Schedule([table, key](ZgwBackend* backend) {
+    StripResult res;
+    res.span.op = ZgwSpan::kGet;
+    res.span.start_us = slash::NowMicros();
+    res.status = backend->Get(table, key, &res.value);
+    res.span.micros = slash::NowMicros() - res.span.start_us;
+    res.span.key = key;
+    res.span.key_size = key.size();
+    res.span.value_size = res.value.size();
+    res.span.ok = res.status.ok();
+    return res;
+  });
+}
+
+void StripPool::ThreadMain(ZgwBackend* backend) {
+  while (true) {
+    Task task;
+    {
+      std::unique_lock<std::mutex> lock(mu_);
+      cv_.wait(lock, [this] { return should_exit_ || !tasks_.empty(); });
+      if (tasks_.empty()) {
+        return;
+      }
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+    task(backend);
+  }
+}
+
+}  // namespace libzgw
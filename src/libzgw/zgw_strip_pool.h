@@ -0,0 +1,67 @@
+#ifndef ZGW_STRIP_POOL_H
+#define ZGW_STRIP_POOL_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+
+#include "slash/include/slash_status.h"
+#include "src/libzgw/zgw_backend.h"
+#include "src/libzgw/zgw_trace.h"
+
+namespace libzgw {
+
+using slash::Status;
+
+struct StripResult {
+  Status status;
+  std::string value;
+  // Timing of the zeppelin call, table left to the caller
+  ZgwSpan span;
+};
+
+// Fixed number of threads, each owning a ZgwBackend, used to keep
+// several strip Set/Get requests in flight for one ZgwStore
+class StripPool {
+ public:
+  // One thread per backend, the pool takes ownership of them
+  explicit StripPool(const std::vector<ZgwBackend*>& backends);
+  ~StripPool();
+
+  int window() const {
+    return static_cast<int>(threads_.size());
+  }
+
+  std::future<StripResult> Set(const std::string& table,
+                               const std::string& key, std::string value);
+  std::future<StripResult> Get(const std::string& table,
+                               const std::string& key);
+  // Run func on a pool thread, with that thread's backend
+  std::future<StripResult> Schedule(std::function<StripResult(ZgwBackend*)> func);
+
+ private:
+  typedef std::packaged_task<StripResult(ZgwBackend*)> Task;
+
+  std::vector<ZgwBackend*> backends_;
+  std::vector<std::thread> threads_;
+  std::mutex mu_;
+  std::condition_variable cv_;
+  std::deque<Task> tasks_;
+  bool should_exit_;
+
+  void ThreadMain(ZgwBackend* backend);
+
+  // No copying allowed
+  StripPool(const StripPool&);
+  void operator=(const StripPool&);
+};
+
+}  // namespace libzgw
+
+#endif  // ZGW_STRIP_POOL_H
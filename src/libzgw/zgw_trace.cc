@@ -0,0 +1,33 @@
+#include "src/libzgw/zgw_trace.h"
+
+#include <cstdio>
+#include <cinttypes>
+
+namespace libzgw {
+
+static const char* kSpanOpNames[] = {
+  "Get",
+  "Set",
+  "Delete",
+  "Mget"
+};
+
+void ZgwTrace::AppendTo(std::string* out) const {
+  char buf[256];
+  for (auto& span : spans_) {
+    int64_t offset = static_cast<int64_t>(span.start_us - start_us_);
+    snprintf(buf, sizeof(buf),
+             "  +%" PRId64 "us %s %s key_size=%" PRIu64 " value_size=%" PRIu64
+             " %" PRIu64 "us %s key=",
+             offset, kSpanOpNames[span.op], span.table, span.key_size,
+             span.value_size, span.micros, span.ok ? "ok" : "failed");
+    out->append(buf);
+    out->append(span.key);
+    out->append("\n");
+  }
+  if (dropped_ > 0) {
+    out->append("  ... " + std::to_string(dropped_) + " more\n");
+  }
+}
+
+}  // namespace libzgw
@@ -0,0 +1,83 @@
+#ifndef ZGW_TRACE_H
+#define ZGW_TRACE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <utility>
+
+namespace libzgw {
+
+// One zeppelin call
+struct ZgwSpan {
+  enum Op {
+    kGet,
+    kSet,
+    kDelete,
+    kMget
+  };
+
+  Op op;
+  // Points to a static table name
+  const char* table;
+  // First key for Mget
+  std::string key;
+  // All keys for Mget
+  uint64_t key_size;
+  uint64_t value_size;
+  uint64_t start_us;
+  uint64_t micros;
+  bool ok;
+
+  ZgwSpan()
+      : op(kGet), table(""), key_size(0), value_size(0),
+        start_us(0), micros(0), ok(true) {
+  }
+};
+
+// zeppelin calls made for one request, in the order they completed.
+// Async strip I/O is added when it is waited for
+class ZgwTrace {
+ public:
+  static const size_t kMaxSpans = 1024;
+
+  ZgwTrace()
+      : start_us_(0),
+        dropped_(0) {
+  }
+
+  void Reset(uint64_t start_us) {
+    spans_.clear();
+    start_us_ = start_us;
+    dropped_ = 0;
+  }
+
+  void Add(ZgwSpan&& span) {
+    if (spans_.size() >= kMaxSpans) {
+      dropped_++;
+      return;
+    }
+    spans_.push_back(std::move(span));
+  }
+
+  const std::vector<ZgwSpan>& spans() const {
+    return spans_;
+  }
+
+  // Spans beyond kMaxSpans
+  uint64_t dropped() const {
+    return dropped_;
+  }
+
+  // One line per span, start relative to Reset
+  void AppendTo(std::string* out) const;
+
+ private:
+  std::vector<ZgwSpan> spans_;
+  uint64_t start_us_;
+  uint64_t dropped_;
+};
+
+}  // namespace libzgw
+
+#endif  // ZGW_TRACE_H
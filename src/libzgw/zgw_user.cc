@@ -2,6 +2,8 @@
 
 #include <sys/time.h>
 
+#include "slash/include/env.h"
+
 namespace libzgw {
 
 std::string ZgwUserList::MetaValue() const {
@@ -127,4 +129,20 @@ std::string ZgwUser::GenRandomStr(int width) {
   return key;
 }
 
+static const uint64_t kUserMissReloadIntervalUs = 1000000;
+
+void ZgwUserTable::Publish(std::shared_ptr<ZgwUserSnapshot> snapshot) {
+  snapshot->generation = generation() + 1;
+  std::shared_ptr<const ZgwUserSnapshot> value(std::move(snapshot));
+  std::atomic_store(&snapshot_, value);
+  generation_.store(value->generation, std::memory_order_release);
+}
+
+bool ZgwUserTable::ShouldReloadOnMiss() {
+  uint64_t now = slash::NowMicros();
+  uint64_t last = last_miss_reload_us_.load();
+  return now - last >= kUserMissReloadIntervalUs &&
+    last_miss_reload_us_.compare_exchange_strong(last, now);
+}
+
 }  // namespace libzgw
@@ -4,6 +4,11 @@
 #include <string>
 #include <set>
 #include <map>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
 #include <cassert>
 #include <sys/time.h>
 
@@ -65,8 +70,10 @@ class ZgwUser {
     return key_pairs_;
   }
 
-  std::string secret_key(std::string access_key) {
-    return key_pairs_[access_key];
+  // Users are shared by all workers, never insert here
+  std::string secret_key(const std::string& access_key) const {
+    auto it = key_pairs_.find(access_key);
+    return it == key_pairs_.end() ? "" : it->second;
   }
 
   // Serialization
@@ -85,6 +92,58 @@ class ZgwUser {
   std::string GenRandomStr(int width);
 };
 
+// Immutable view of all users, built from one user list value
+struct ZgwUserSnapshot {
+  uint64_t generation;
+  // User list meta value this was built from
+  std::string list_value;
+  std::vector<std::unique_ptr<ZgwUser>> users;
+  std::unordered_map<std::string, ZgwUser*> access_key_user_map;
+
+  ZgwUserSnapshot() : generation(0) {}
+
+  ZgwUser* Find(const std::string& access_key) const {
+    auto it = access_key_user_map.find(access_key);
+    return it == access_key_user_map.end() ? NULL : it->second;
+  }
+};
+
+// Process wide user table shared by every ZgwStore. Readers keep the
+// snapshot they got and only fetch a new one when generation() moves,
+// a reload publishes a whole new snapshot
+class ZgwUserTable {
+ public:
+  ZgwUserTable()
+      : generation_(0),
+        last_miss_reload_us_(0) {
+  }
+
+  uint64_t generation() const {
+    return generation_.load(std::memory_order_acquire);
+  }
+
+  std::shared_ptr<const ZgwUserSnapshot> snapshot() const {
+    return std::atomic_load(&snapshot_);
+  }
+
+  void Publish(std::shared_ptr<ZgwUserSnapshot> snapshot);
+
+  // An unknown access key may reload users at most once per interval
+  bool ShouldReloadOnMiss();
+
+  // Serialize reloads
+  std::mutex load_mutex;
+
+ private:
+  std::atomic<uint64_t> generation_;
+  std::atomic<uint64_t> last_miss_reload_us_;
+  std::shared_ptr<const ZgwUserSnapshot> snapshot_;
+
+  // No copying allowed
+  ZgwUserTable(const ZgwUserTable&);
+  void operator=(const ZgwUserTable&);
+};
+
 }  // namespace libzgw
 
 #endif
@@ -22,6 +22,8 @@ void AdminConn::DealMessage(const pink::HttpRequest* req, pink::HttpResponse* re
       ListUsersHandle(resp);
     } else if (command == "status") {
       ListStatusHandle(resp);
+    } else if (command == "metrics") {
+      MetricsHandle(resp);
     }
     return;
   } else if (req->method == "PUT" &&
@@ -44,6 +46,95 @@ void AdminConn::DealMessage(const pink::HttpRequest* req, pink::HttpResponse* re
   }
 }
 
+static void AppendListMapStats(const std::string& name,
+                               const libzgw::ListMapStats& stats,
+                               std::string* body) {
+  body->append(name + " name list cache: hits " + std::to_string(stats.hits)
+               + ", misses " + std::to_string(stats.misses)
+               + ", evictions " + std::to_string(stats.evictions)
+               + ", flushes " + std::to_string(stats.flushes)
+               + ", resident " + std::to_string(stats.resident)
+               + " lists " + std::to_string(stats.resident_bytes)
+               + " bytes\r\n");
+}
+
+// Samples of one metric must be together, so buckets and objects are
+// written side by side
+static void AppendListMapMetric(const std::string& name, const std::string& type,
+                                uint64_t buckets, uint64_t objects,
+                                std::string* body) {
+  body->append("# TYPE " + name + " " + type + "\n");
+  body->append(name + "{list=\"buckets\"} " + std::to_string(buckets) + "\n");
+  body->append(name + "{list=\"objects\"} " + std::to_string(objects) + "\n");
+}
+
+void AdminConn::MetricsHandle(pink::HttpResponse* resp) {
+  std::string body;
+  g_zgw_server->metrics()->AppendPrometheus(&body);
+  body.append("# TYPE zgw_qps gauge\n");
+  body.append("zgw_qps " + std::to_string(g_zgw_server->qps()) + "\n");
+  libzgw::ListMapStats buckets_stats, objects_stats;
+  g_zgw_server->GetListMapStats(&buckets_stats, &objects_stats);
+  AppendListMapMetric("zgw_name_list_cache_hits_total", "counter",
+                      buckets_stats.hits, objects_stats.hits, &body);
+  AppendListMapMetric("zgw_name_list_cache_misses_total", "counter",
+                      buckets_stats.misses, objects_stats.misses, &body);
+  AppendListMapMetric("zgw_name_list_cache_evictions_total", "counter",
+                      buckets_stats.evictions, objects_stats.evictions, &body);
+  AppendListMapMetric("zgw_name_list_flushes_total", "counter",
+                      buckets_stats.flushes, objects_stats.flushes, &body);
+  AppendListMapMetric("zgw_name_list_resident", "gauge",
+                      buckets_stats.resident, objects_stats.resident, &body);
+  AppendListMapMetric("zgw_name_list_resident_bytes", "gauge",
+                      buckets_stats.resident_bytes, objects_stats.resident_bytes,
+                      &body);
+  libzgw::StripGc* strip_gc = g_zgw_server->strip_gc();
+  body.append("# TYPE zgw_strip_gc_queued gauge\n");
+  body.append("zgw_strip_gc_queued " + std::to_string(strip_gc->queued()) + "\n");
+  body.append("# TYPE zgw_strip_gc_deleted_total counter\n");
+  body.append("zgw_strip_gc_deleted_total " + std::to_string(strip_gc->deleted())
+              + "\n");
+  if (g_zgw_server->strip_cache() != NULL) {
+    libzgw::StripCacheStats stats;
+    g_zgw_server->strip_cache()->GetStats(&stats);
+    const std::pair<const char*, uint64_t> counters[] = {
+      {"hits", stats.hits}, {"misses", stats.misses},
+      {"inserts", stats.inserts}, {"rejects", stats.rejects},
+      {"evictions", stats.evictions}};
+    for (auto& c : counters) {
+      body.append(std::string("# TYPE zgw_strip_cache_") + c.first + "_total counter\n");
+      body.append(std::string("zgw_strip_cache_") + c.first + "_total "
+                  + std::to_string(c.second) + "\n");
+    }
+    body.append("# TYPE zgw_strip_cache_resident gauge\n");
+    body.append("zgw_strip_cache_resident " + std::to_string(stats.resident) + "\n");
+    body.append("# TYPE zgw_strip_cache_resident_bytes gauge\n");
+    body.append("zgw_strip_cache_resident_bytes "
+                + std::to_string(stats.resident_bytes) + "\n");
+  }
+  if (g_zgw_server->meta_cache() != NULL) {
+    libzgw::MetaCacheStats stats;
+    g_zgw_server->meta_cache()->GetStats(&stats);
+    const std::pair<const char*, uint64_t> counters[] = {
+      {"hits", stats.hits}, {"misses", stats.misses},
+      {"expired", stats.expired}, {"invalidations", stats.invalidations},
+      {"stale_inserts", stats.stale_inserts}, {"evictions", stats.evictions}};
+    for (auto& c : counters) {
+      body.append(std::string("# TYPE zgw_meta_cache_") + c.first + "_total counter\n");
+      body.append(std::string("zgw_meta_cache_") + c.first + "_total "
+                  + std::to_string(c.second) + "\n");
+    }
+    body.append("# TYPE zgw_meta_cache_resident gauge\n");
+    body.append("zgw_meta_cache_resident " + std::to_string(stats.resident) + "\n");
+    body.append("# TYPE zgw_meta_cache_resident_bytes gauge\n");
+    body.append("zgw_meta_cache_resident_bytes "
+                + std::to_string(stats.resident_bytes) + "\n");
+  }
+  resp->SetStatusCode(200);
+  resp->SetHeaders("Content-Type", "text/plain; version=0.0.4");
+  resp->SetBody(body);
+}
+
 void AdminConn::ListStatusHandle(pink::HttpResponse* resp) {
   std::string body;
   std::set<libzgw::ZgwUser *> user_list; // name : keys
@@ -54,6 +145,60 @@ void AdminConn::ListStatusHandle(pink::HttpResponse* resp) {
   }
   // Buckets qps
   body.append("Global qps: " + std::to_string(g_zgw_server->qps()) + "\r\n");
+  // Latency of the operations seen so far
+  for (int op = 0; op < kOpCount; op++) {
+    HistogramSnapshot hist;
+    g_zgw_server->metrics()->GetRequestHistogram(static_cast<ZgwOp>(op), &hist);
+    if (hist.count == 0) {
+      continue;
+    }
+    body.append(std::string(ZgwOpName(static_cast<ZgwOp>(op))) + ": "
+                + std::to_string(hist.count) + " requests, p50 "
+                + std::to_string(hist.Percentile(0.5)) + "us, p99 "
+                + std::to_string(hist.Percentile(0.99)) + "us, p999 "
+                + std::to_string(hist.Percentile(0.999)) + "us\r\n");
+  }
+  // Name list cache
+  libzgw::ListMapStats buckets_stats, objects_stats;
+  g_zgw_server->GetListMapStats(&buckets_stats, &objects_stats);
+  AppendListMapStats("Bucket", buckets_stats, &body);
+  AppendListMapStats("Object", objects_stats, &body);
+  libzgw::StripGc* strip_gc = g_zgw_server->strip_gc();
+  body.append("Strip gc: queued " + std::to_string(strip_gc->queued())
+              + ", deleted " + std::to_string(strip_gc->deleted()) + "\r\n");
+  if (g_zgw_server->strip_cache() != NULL) {
+    libzgw::StripCacheStats stats;
+    g_zgw_server->strip_cache()->GetStats(&stats);
+    uint64_t lookups = stats.hits + stats.misses;
+    char hit_rate[16];
+    snprintf(hit_rate, sizeof(hit_rate), "%.2f%%",
+             lookups == 0 ? 0.0 : 100.0 * stats.hits / lookups);
+    body.append("Strip cache: hits " + std::to_string(stats.hits)
+                + ", misses " + std::to_string(stats.misses)
+                + ", hit rate " + hit_rate
+                + ", rejects " + std::to_string(stats.rejects)
+                + ", evictions " + std::to_string(stats.evictions)
+                + ", resident " + std::to_string(stats.resident)
+                + " strips " + std::to_string(stats.resident_bytes)
+                + " bytes\r\n");
+  }
+  if (g_zgw_server->meta_cache() != NULL) {
+    libzgw::MetaCacheStats stats;
+    g_zgw_server->meta_cache()->GetStats(&stats);
+    uint64_t lookups = stats.hits + stats.misses;
+    char hit_rate[16];
+    snprintf(hit_rate, sizeof(hit_rate), "%.2f%%",
+             lookups == 0 ? 0.0 : 100.0 * stats.hits / lookups);
+    body.append("Object meta cache: hits " + std::to_string(stats.hits)
+                + ", misses " + std::to_string(stats.misses)
+                + ", hit rate " + hit_rate
+                + ", expired " + std::to_string(stats.expired)
+                + ", invalidations " + std::to_string(stats.invalidations)
+                + ", evictions " + std::to_string(stats.evictions)
+                + ", resident " + std::to_string(stats.resident)
+                + " metas " + std::to_string(stats.resident_bytes)
+                + " bytes\r\n");
+  }
   // Buckets nums
   std::string access_key;
   for (auto& user : user_list) {
@@ -67,15 +212,17 @@ void AdminConn::ListStatusHandle(pink::HttpResponse* resp) {
       LOG(ERROR) << "ListStatus: list bucket name failed: " << s.ToString();
       return;
     }
-    body.append("User: " + info.disply_name + " has "
-                + std::to_string(buckets_name_->name_list.size())
-                + " Buckets\r\n");
     std::set<std::string> name_list;
-    {
-      std::lock_guard<std::mutex> lock(buckets_name_->list_lock);
-      name_list = buckets_name_->name_list;
-    }
+    s = buckets_name_->ListAll(store_, &name_list);
     g_zgw_server->UnrefBucketList(store_, access_key);
+    if (!s.ok()) {
+      resp->SetStatusCode(500);
+      LOG(ERROR) << "ListStatus: list bucket name failed: " << s.ToString();
+      return;
+    }
+    body.append("User: " + info.disply_name + " has "
+                + std::to_string(name_list.size())
+                + " Buckets\r\n");
     for (const auto& name : name_list) {
       s = g_zgw_server->RefAndGetObjectList(store_, name, &objects_name_);
       if (!s.ok()) {
@@ -83,10 +230,17 @@ void AdminConn::ListStatusHandle(pink::HttpResponse* resp) {
         LOG(ERROR) << "ListStatus: list object name failed: " << s.ToString();
         return;
       }
+      uint64_t object_num = 0;
+      s = objects_name_->Size(store_, &object_num);
+      g_zgw_server->UnrefObjectList(store_, name);
+      if (!s.ok()) {
+        resp->SetStatusCode(500);
+        LOG(ERROR) << "ListStatus: count object name failed: " << s.ToString();
+        return;
+      }
       body.append("    Bucket: " + name + " has "
-                  + std::to_string(objects_name_->name_list.size())
+                  + std::to_string(object_num)
                   + " Objects.\r\n");
-      g_zgw_server->UnrefObjectList(store_, name);
     }
   }
   // Bucket space TODO (gaodq)
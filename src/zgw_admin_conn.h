@@ -14,6 +14,8 @@ class AdminConn : public pink::HttpConn {
 
   void ListUsersHandle(pink::HttpResponse* resp);
   void ListStatusHandle(pink::HttpResponse* resp);
+  // Prometheus text format
+  void MetricsHandle(pink::HttpResponse* resp);
 
   libzgw::ZgwStore *store_;
 
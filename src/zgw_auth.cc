@@ -1,12 +1,105 @@
 #include "src/zgw_auth.h"
 
 #include <cctype>
+#include <cstring>
+#include <algorithm>
+#include <unordered_map>
 
 #include <openssl/hmac.h>
+#include <openssl/sha.h>
 #include "slash/include/slash_string.h"
 #include "slash/include/slash_hash.h"
 
-static std::string HMAC_SHA256(const std::string key, const std::string value, bool raw = true);
+static const unsigned int kSha256Len = 32;
+static const std::string kStreamingPayload = "STREAMING-AWS4-HMAC-SHA256-PAYLOAD";
+static const char kEmptySha256[] =
+  "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855";
+// <16 hex digits>;chunk-signature=<64 hex digits>\r\n
+static const size_t kMaxChunkHeaderLen = 128;
+// Keys roll over daily, the cache is simply dropped when full
+static const size_t kMaxSigningKeys = 1024;
+
+// HMAC_Init_ex with a new key resets the context, so each worker
+// thread keeps one for all of its requests
+struct HmacContext {
+  HMAC_CTX ctx;
+
+  HmacContext() {
+    HMAC_CTX_init(&ctx);
+  }
+
+  ~HmacContext() {
+    HMAC_CTX_cleanup(&ctx);
+  }
+};
+
+struct SigningKey {
+  unsigned char key[kSha256Len];
+};
+
+static thread_local HmacContext hmac_context;
+// secret key/date/region : signing key
+static thread_local std::unordered_map<std::string, SigningKey> signing_keys;
+
+static void HmacSha256(const void* key, size_t key_len,
+                       const char* value, size_t value_len,
+                       unsigned char* digest) {
+  unsigned int digest_len = kSha256Len;
+  HMAC_CTX* ctx = &hmac_context.ctx;
+  HMAC_Init_ex(ctx, key, key_len, EVP_sha256(), NULL);
+  HMAC_Update(ctx, reinterpret_cast<const unsigned char*>(value), value_len);
+  HMAC_Final(ctx, digest, &digest_len);
+}
+
+static void HmacSha256(const void* key, size_t key_len,
+                       const std::string& value, unsigned char* digest) {
+  HmacSha256(key, key_len, value.data(), value.size(), digest);
+}
+
+// date_key -> region -> "s3" -> "aws4_request" chain, computed once per
+// secret key, date and region on each worker thread
+static const unsigned char* GetSigningKey(const std::string& secret_key,
+                                          const std::string& date,
+                                          const std::string& region) {
+  static thread_local std::string cache_key;
+  cache_key.assign(secret_key).append(1, '/').append(date)
+    .append(1, '/').append(region);
+  auto it = signing_keys.find(cache_key);
+  if (it != signing_keys.end()) {
+    return it->second.key;
+  }
+
+  if (signing_keys.size() >= kMaxSigningKeys) {
+    signing_keys.clear();
+  }
+  unsigned char key1[kSha256Len], key2[kSha256Len];
+  std::string aws4_secret = "AWS4" + secret_key;
+  HmacSha256(aws4_secret.data(), aws4_secret.size(), date, key1);
+  HmacSha256(key1, kSha256Len, region, key2);
+  HmacSha256(key2, kSha256Len, "s3", 2, key1);
+  SigningKey& signing_key = signing_keys[cache_key];
+  HmacSha256(key1, kSha256Len, "aws4_request", 12, signing_key.key);
+  return signing_key.key;
+}
+
+static void HexEncode(const unsigned char* in, size_t len, char* out) {
+  static const char kHex[] = "0123456789abcdef";
+  for (size_t i = 0; i < len; i++) {
+    out[i * 2] = kHex[in[i] >> 4];
+    out[i * 2 + 1] = kHex[in[i] & 0xf];
+  }
+  out[len * 2] = '\0';
+}
+
+void ZgwAuth::ClearSigningKeyCache() {
+  signing_keys.clear();
+}
+
+void ZgwAuth::InitChunkDecoder(const std::string& secret_key,
+                               ZgwChunkDecoder* decoder) const {
+  decoder->Init(GetSigningKey(secret_key, date_, region_), iso_date_,
+                date_ + "/" + region_ + "/s3/aws4_request", signature_);
+}
 
 bool ZgwAuth::ParseAuthInfo(const pink::HttpRequest* req, std::string* access_key) {
   // Parse authorization string
@@ -18,30 +111,54 @@ bool ZgwAuth::ParseAuthInfo(const pink::HttpRequest* req, std::string* access_ke
   return true;
 }
 
-bool ZgwAuth::Auth(const pink::HttpRequest* req, const std::string& secret_key) {
+void ZgwAuth::CalcSignature(const pink::HttpRequest* req,
+                            const std::string& secret_key, char* signature) {
   // Task 1: Create a Canonical Request
   std::string canonical_request = CreateCanonicalRequest(req);
   canonical_request_ = canonical_request;
   // Task 2: Create a String to Sign
-  pink::HttpRequest *req_tmp = const_cast<pink::HttpRequest *>(req);
   std::string string_to_sign;
   string_to_sign.append(encryption_method_ + "\n");
   string_to_sign.append(iso_date_ + "\n");
   string_to_sign.append(date_ + "/" + region_ + "/s3/aws4_request\n");
   string_to_sign.append(slash::sha256(canonical_request));
   // Task 3: Calculate Signature
-  std::string date_key = HMAC_SHA256("AWS4" + secret_key, date_);
-  std::string date_region_key = HMAC_SHA256(date_key, region_);
-  std::string date_region_service_key = HMAC_SHA256(date_region_key, "s3");
-  std::string signing_key = HMAC_SHA256(date_region_service_key, "aws4_request");
+  const unsigned char* signing_key = GetSigningKey(secret_key, date_, region_);
+  unsigned char digest[kSha256Len];
+  HmacSha256(signing_key, kSha256Len, string_to_sign, digest);
+  HexEncode(digest, kSha256Len, signature);
+}
 
-  std::string signature = HMAC_SHA256(signing_key, string_to_sign, false);
-  if (signature != signature_) {
+bool ZgwAuth::Auth(const pink::HttpRequest* req, const std::string& secret_key) {
+  char signature[kSha256Len * 2 + 1];
+  CalcSignature(req, secret_key, signature);
+  if (signature_ != signature) {
     return false;
   }
   return true;
 }
 
+bool ZgwAuth::Sign(pink::HttpRequest* req, const std::string& access_key,
+                   const std::string& secret_key, const std::string& iso_date) {
+  static const std::string kSignedHeaders = "host;x-amz-content-sha256;x-amz-date";
+  req->headers["x-amz-date"] = iso_date;
+  req->headers["x-amz-content-sha256"] = "UNSIGNED-PAYLOAD";
+  // Parsed back to fill in what CalcSignature needs, the zeros are replaced
+  std::string auth_str = "AWS4-HMAC-SHA256 Credential=" + access_key + "/" +
+    iso_date.substr(0, 8) + "/us-east-1/s3/aws4_request,SignedHeaders=" +
+    kSignedHeaders + ",Signature=";
+  req->headers["authorization"] = auth_str + std::string(kSha256Len * 2, '0');
+
+  ZgwAuth auth;
+  if (!auth.ParseAuthStr(req->headers)) {
+    return false;
+  }
+  char signature[kSha256Len * 2 + 1];
+  auth.CalcSignature(req, secret_key, signature);
+  req->headers["authorization"] = auth_str + signature;
+  return true;
+}
+
 bool ZgwAuth::ParseCredential(const std::string& credential_str) {
   // tC22yNVe9FJ9S0vs5OYx/20170306/us-east-1/s3/aws4_request
   std::vector<std::string> items;
@@ -130,37 +247,165 @@ bool ZgwAuth::ParseAuthStr(const std::map<std::string, std::string>& headers) {
   // 20170328T093456Z
   iso_date_ = headers.at("x-amz-date");
 
+  auto sha256_header = headers.find("x-amz-content-sha256");
+  is_streaming_payload_ = sha256_header != headers.end() &&
+    sha256_header->second == kStreamingPayload;
   is_presign_url_ = false;
   return true;
 }
 
-std::string HMAC_SHA256(const std::string key, const std::string value, bool raw) {
-  static unsigned int digest_len = 32;
-  unsigned char* digest = new unsigned char[digest_len];
+ZgwChunkDecoder::ZgwChunkDecoder()
+      : state_(kHeader),
+        chunk_size_(0),
+        decoded_size_(0) {
+  memset(signing_key_, 0, sizeof(signing_key_));
+}
 
-  HMAC_CTX ctx;
-  HMAC_CTX_init(&ctx);
+void ZgwChunkDecoder::Init(const unsigned char* signing_key,
+                           const std::string& iso_date,
+                           const std::string& scope,
+                           const std::string& seed_signature) {
+  memcpy(signing_key_, signing_key, sizeof(signing_key_));
+  iso_date_ = iso_date;
+  scope_ = scope;
+  prev_signature_ = seed_signature;
+  state_ = kHeader;
+  header_.clear();
+  chunk_size_ = 0;
+  chunk_buf_.clear();
+  decoded_size_ = 0;
+}
 
-  HMAC_Init_ex(&ctx, key.data(), key.size(), EVP_sha256(), NULL);
-  HMAC_Update(&ctx, (unsigned char*)value.data(), value.size());
-  HMAC_Final(&ctx, digest, &digest_len);
-  HMAC_CTX_cleanup(&ctx);
+Status ZgwChunkDecoder::Decode(const char* data, size_t size, const Sink& sink) {
+  Status s;
+  while (size > 0) {
+    switch (state_) {
+      case kHeader: {
+        const char* lf = static_cast<const char*>(memchr(data, '\n', size));
+        size_t n = lf ? lf - data + 1 : size;
+        header_.append(data, n);
+        data += n;
+        size -= n;
+        if (header_.size() > kMaxChunkHeaderLen) {
+          return Status::Corruption("Chunk header too long");
+        }
+        if (lf == NULL) {
+          break;
+        }
+        s = ParseHeader();
+        if (!s.ok()) {
+          return s;
+        }
+        header_.clear();
+        if (chunk_size_ == 0) {
+          // Final chunk
+          s = VerifyChunk(data, 0, sink);
+          if (!s.ok()) {
+            return s;
+          }
+          state_ = kDataEnd;
+        } else {
+          state_ = kData;
+        }
+        break;
+      }
+      case kData: {
+        size_t need = chunk_size_ - chunk_buf_.size();
+        if (chunk_buf_.empty() && size >= need) {
+          // Whole chunk at hand, verify it in place
+          s = VerifyChunk(data, need, sink);
+          data += need;
+          size -= need;
+        } else {
+          size_t n = std::min(need, size);
+          chunk_buf_.append(data, n);
+          data += n;
+          size -= n;
+          if (chunk_buf_.size() < chunk_size_) {
+            break;
+          }
+          s = VerifyChunk(chunk_buf_.data(), chunk_buf_.size(), sink);
+          chunk_buf_.clear();
+        }
+        if (!s.ok()) {
+          return s;
+        }
+        state_ = kDataEnd;
+        break;
+      }
+      case kDataEnd: {
+        header_.push_back(*data++);
+        size--;
+        if (header_.size() < 2) {
+          break;
+        }
+        if (header_ != "\r\n") {
+          return Status::Corruption("Chunk data not followed by CRLF");
+        }
+        header_.clear();
+        state_ = chunk_size_ == 0 ? kDone : kHeader;
+        break;
+      }
+      case kDone:
+        return Status::Corruption("Data after the final chunk");
+    }
+  }
+  return Status::OK();
+}
 
-  std::string res;
-  if (raw) {
-    for (unsigned int i = 0; i < digest_len; ++i) {
-      res.append(1, digest[i]);
+Status ZgwChunkDecoder::ParseHeader() {
+  // 10000;chunk-signature=ad80c730a21e5b8d04586a2213dd63b9a0e99e0e2307b0ade35a65485a288648\r\n
+  static const std::string kSignatureTag = ";chunk-signature=";
+  if (header_.size() < 2 || header_.compare(header_.size() - 2, 2, "\r\n") != 0) {
+    return Status::Corruption("Chunk header not ended by CRLF");
+  }
+  size_t pos = header_.find(kSignatureTag);
+  if (pos == 0 || pos == std::string::npos || pos > 16) {
+    return Status::Corruption("Invalid chunk size");
+  }
+  chunk_size_ = 0;
+  for (size_t i = 0; i < pos; i++) {
+    char c = std::tolower(header_[i]);
+    if (!std::isxdigit(c)) {
+      return Status::Corruption("Invalid chunk size");
     }
-    return res;
+    chunk_size_ = chunk_size_ * 16 + (c >= 'a' ? 10 + c - 'a' : c - '0');
   }
+  chunk_signature_ = header_.substr(pos + kSignatureTag.size(),
+                                    header_.size() - 2 - pos - kSignatureTag.size());
+  if (chunk_signature_.size() != kSha256Len * 2) {
+    return Status::Corruption("Invalid chunk signature");
+  }
+  return Status::OK();
+}
+
+Status ZgwChunkDecoder::VerifyChunk(const char* data, size_t size,
+                                    const Sink& sink) {
+  unsigned char digest[kSha256Len];
+  char hex[kSha256Len * 2 + 1];
+  SHA256(reinterpret_cast<const unsigned char*>(data), size, digest);
+  HexEncode(digest, kSha256Len, hex);
 
-  // Hex
-  char buf[65] = {0};
-  for (unsigned int i = 0; i < digest_len; ++i) {
-    sprintf(buf + i * 2, "%02x", (unsigned int)digest[i]);
+  std::string string_to_sign;
+  string_to_sign.append("AWS4-HMAC-SHA256-PAYLOAD\n");
+  string_to_sign.append(iso_date_ + "\n");
+  string_to_sign.append(scope_ + "\n");
+  string_to_sign.append(prev_signature_ + "\n");
+  string_to_sign.append(kEmptySha256);
+  string_to_sign.append("\n");
+  string_to_sign.append(hex);
+
+  HmacSha256(signing_key_, kSha256Len, string_to_sign, digest);
+  HexEncode(digest, kSha256Len, hex);
+  if (chunk_signature_ != hex) {
+    return Status::AuthFailed("Chunk signature does not match");
+  }
+  prev_signature_.assign(hex);
+  decoded_size_ += size;
+  if (size == 0) {
+    return Status::OK();
   }
-  delete[] digest;
-  return std::string(buf);
+  return sink(data, size);
 }
 
 inline void char2hex(unsigned char c, unsigned char &hex1, unsigned char &hex2) {
@@ -3,25 +3,53 @@
 
 #include <iostream>
 #include <string>
+#include <functional>
 
 #include "pink/include/http_conn.h"
+#include "slash/include/slash_status.h"
+
+using slash::Status;
 
 extern std::string UrlEncode(const std::string& s, bool encode_slash = false);
 extern std::string UrlDecode(const std::string& url);
 
+class ZgwChunkDecoder;
+
 class ZgwAuth {
  public:
-  ZgwAuth() {}
+  ZgwAuth()
+      : is_presign_url_(false),
+        is_streaming_payload_(false) {
+  }
 
   bool ParseAuthInfo(const pink::HttpRequest* req, std::string* access_key);
   bool Auth(const pink::HttpRequest *req, const std::string& secret_key);
 
+  // Client side: sign req with its host header, payload left unsigned.
+  // iso_date is like 20170328T093456Z
+  static bool Sign(pink::HttpRequest* req, const std::string& access_key,
+                   const std::string& secret_key, const std::string& iso_date);
+
+  // x-amz-content-sha256 is STREAMING-AWS4-HMAC-SHA256-PAYLOAD, the body
+  // is aws-chunked, signed chunk by chunk from the request signature
+  bool is_streaming_payload() const {
+    return is_streaming_payload_;
+  }
+
+  // Valid after Auth passed
+  void InitChunkDecoder(const std::string& secret_key,
+                        ZgwChunkDecoder* decoder) const;
+
+  // Drop the signing keys cached by the calling thread
+  static void ClearSigningKeyCache();
+
   std::string canonical_request() {
     return canonical_request_;
   }
 
  private:
   bool is_presign_url_;
+  bool is_streaming_payload_;
   std::string encryption_method_;
   std::string date_;
   std::string iso_date_;
@@ -36,6 +64,59 @@ class ZgwAuth {
   bool ParseQueryAuthStr(const std::map<std::string, std::string>& query_params);
   bool ParseCredential(const std::string& credential_str);
   std::string CreateCanonicalRequest(const pink::HttpRequest *req);
+  // 64 hex digits and a '\0' into signature
+  void CalcSignature(const pink::HttpRequest* req,
+                     const std::string& secret_key, char* signature);
+};
+
+// Decode an aws-chunked body piece by piece. Each chunk is
+//   <hex size>;chunk-signature=<signature>\r\n<data>\r\n
+// and ends with a zero size one. The data of a chunk is passed on only
+// after its signature, chained from the previous one, is verified
+class ZgwChunkDecoder {
+ public:
+  typedef std::function<Status(const char* data, size_t size)> Sink;
+
+  ZgwChunkDecoder();
+
+  void Init(const unsigned char* signing_key, const std::string& iso_date,
+            const std::string& scope, const std::string& seed_signature);
+
+  // Corruption on a malformed body, AuthFailed on a bad chunk signature,
+  // otherwise what sink returns
+  Status Decode(const char* data, size_t size, const Sink& sink);
+
+  // The final chunk has been verified
+  bool finished() const {
+    return state_ == kDone;
+  }
+
+  uint64_t decoded_size() const {
+    return decoded_size_;
+  }
+
+ private:
+  enum State {
+    kHeader,
+    kData,
+    kDataEnd,
+    kDone
+  };
+
+  unsigned char signing_key_[32];
+  std::string iso_date_;
+  std::string scope_;
+  std::string prev_signature_;
+  State state_;
+  std::string header_;
+  uint64_t chunk_size_;
+  std::string chunk_signature_;
+  // Data of the current chunk when it spans several Decode calls
+  std::string chunk_buf_;
+  uint64_t decoded_size_;
+
+  Status ParseHeader();
+  Status VerifyChunk(const char* data, size_t size, const Sink& sink);
 };
 
 #endif
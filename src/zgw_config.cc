@@ -6,12 +6,27 @@
 #include "src/zgw_const.h"
 
 ZgwConfig::ZgwConfig(std::string path)
-      : server_ip("0.0.0.0"),
+      : backend("zeppelin"),
+        memory_backend_latency_us(0),
+        memory_backend_latency_jitter_us(0),
+        server_ip("0.0.0.0"),
         server_port(8099),
         admin_port(8199),
         daemonize(false),
         minloglevel(0),
         worker_num(2),
+        strip_io_window(4),
+        inline_object_max_bytes(0),
+        content_addressed_strips(false),
+        strip_cache_mb(0),
+        object_meta_cache_mb(0),
+        object_meta_cache_ttl_ms(1000),
+        name_list_cache_mb(256),
+        name_list_flush_interval_ms(1000),
+        name_list_flush_mutations(1024),
+        name_list_sync_flush(false),
+        name_list_revalidate_ms(1000),
+        slow_request_ms(1000),
         log_path("./log"),
         pid_file(kZgwPidFile) {
   b_conf = new slash::BaseConf(path);
@@ -25,15 +40,51 @@ int ZgwConfig::LoadConf() {
   if (b_conf->LoadConf() != 0)
     return -1;
 
+  b_conf->GetConfStr("backend", &backend);
   std::string zp_meta_addr;
   b_conf->GetConfStr("zp_meta_addr", &zp_meta_addr);
   slash::StringSplit(zp_meta_addr, '/', zp_meta_ip_ports);
+  b_conf->GetConfInt("memory_backend_latency_us", &memory_backend_latency_us);
+  b_conf->GetConfInt("memory_backend_latency_jitter_us",
+                     &memory_backend_latency_jitter_us);
   b_conf->GetConfStr("server_ip", &server_ip);
   b_conf->GetConfInt("server_port", &server_port);
   b_conf->GetConfInt("admin_port", &admin_port);
   b_conf->GetConfBool("daemonize", &daemonize);
   b_conf->GetConfInt("minloglevel", &minloglevel);
   b_conf->GetConfInt("worker_num", &worker_num);
+  b_conf->GetConfInt("strip_io_window", &strip_io_window);
+  int strip_len_kb = libzgw::kObjectDataStripLen >> 10;
+  std::string strip_len_classes;
+  b_conf->GetConfInt("strip_len_kb", &strip_len_kb);
+  b_conf->GetConfStr("strip_len_classes", &strip_len_classes);
+  slash::Status s = libzgw::StripLenPolicy::Parse(
+      static_cast<uint32_t>(strip_len_kb) << 10, strip_len_classes,
+      &strip_len_policy);
+  if (strip_len_kb <= 0 || !s.ok()) {
+    std::cerr << "Invalid strip length config: " << s.ToString() << std::endl;
+    return -1;
+  }
+  b_conf->GetConfInt("inline_object_max_bytes", &inline_object_max_bytes);
+  if (inline_object_max_bytes < 0 ||
+      inline_object_max_bytes > static_cast<int>(libzgw::kMaxObjectInlineSize)) {
+    std::cerr << "Invalid inline_object_max_bytes" << std::endl;
+    return -1;
+  }
+  b_conf->GetConfBool("content_addressed_strips", &content_addressed_strips);
+  b_conf->GetConfInt("strip_cache_mb", &strip_cache_mb);
+  b_conf->GetConfInt("object_meta_cache_mb", &object_meta_cache_mb);
+  b_conf->GetConfInt("object_meta_cache_ttl_ms", &object_meta_cache_ttl_ms);
+  if (object_meta_cache_mb > 0 && object_meta_cache_ttl_ms <= 0) {
+    std::cerr << "Invalid object_meta_cache_ttl_ms" << std::endl;
+    return -1;
+  }
+  b_conf->GetConfInt("name_list_cache_mb", &name_list_cache_mb);
+  b_conf->GetConfInt("name_list_flush_interval_ms", &name_list_flush_interval_ms);
+  b_conf->GetConfInt("name_list_flush_mutations", &name_list_flush_mutations);
+  b_conf->GetConfBool("name_list_sync_flush", &name_list_sync_flush);
+  b_conf->GetConfInt("name_list_revalidate_ms", &name_list_revalidate_ms);
+  b_conf->GetConfInt("slow_request_ms", &slow_request_ms);
   b_conf->GetConfStr("log_path", &log_path);
   b_conf->GetConfStr("pid_file", &pid_file);
 
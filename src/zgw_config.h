@@ -4,6 +4,7 @@
 #include <string>
 
 #include "slash/include/base_conf.h"
+#include "src/libzgw/zgw_object.h"
 
 struct ZgwConfig {
   explicit ZgwConfig(std::string path);
@@ -14,7 +15,11 @@ struct ZgwConfig {
 
   slash::BaseConf *b_conf;
 
+  // zeppelin or memory
+  std::string backend;
   std::vector<std::string> zp_meta_ip_ports;
+  int memory_backend_latency_us;
+  int memory_backend_latency_jitter_us;
   std::string server_ip;
   int server_port;
   int admin_port;
@@ -22,6 +27,19 @@ struct ZgwConfig {
   int minloglevel;
   int cron_interval;
   int worker_num;
+  int strip_io_window;
+  libzgw::StripLenPolicy strip_len_policy;
+  int inline_object_max_bytes;
+  bool content_addressed_strips;
+  int strip_cache_mb;
+  int object_meta_cache_mb;
+  int object_meta_cache_ttl_ms;
+  int name_list_cache_mb;
+  int name_list_flush_interval_ms;
+  int name_list_flush_mutations;
+  bool name_list_sync_flush;
+  int name_list_revalidate_ms;
+  int slow_request_ms;
 
   std::string log_path;
   std::string pid_file;
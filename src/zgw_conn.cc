@@ -1,14 +1,18 @@
 #include "src/zgw_conn.h"
 
 #include <memory>
+#include <algorithm>
 #include <cctype>
 #include <cstdint>
+#include <ctime>
 
 #include "src/libzgw/zgw_namelist.h"
+#include "src/libzgw/zgw_stream.h"
 #include "src/zgw_server.h"
 #include "src/zgw_auth.h"
 #include "src/zgw_xml.h"
 #include "src/zgw_util.h"
+#include "slash/include/env.h"
 
 extern ZgwServer* g_zgw_server;
 
@@ -44,19 +48,130 @@ bool ZgwConn::IsValidObject() {
 ZgwConn::ZgwConn(const int fd,
                  const std::string &ip_port,
                  pink::Thread* worker)
-      : HttpConn(fd, ip_port, worker) {
+      : HttpConn(fd, ip_port, worker),
+        streaming_payload_(false),
+        metrics_(g_zgw_server->metrics()),
+        op_(kOpUnknown),
+        buckets_name_(NULL),
+        objects_name_(NULL) {
 	store_ = static_cast<libzgw::ZgwStore*>(worker->get_private());
 }
 
+// Account a request to its operation when DealMessage returns, and
+// log it with its zeppelin calls if it is slow
+class ZgwConn::RequestScope {
+ public:
+  explicit RequestScope(ZgwConn* conn)
+      : conn_(conn),
+        slow_log_(g_zgw_server->slow_log()),
+        io_start_(conn->store_->io_micros()),
+        start_us_(slash::NowMicros()) {
+    if (slow_log_->enabled()) {
+      conn_->trace_.Reset(start_us_);
+      conn_->store_->set_trace(&conn_->trace_);
+    }
+  }
+
+  ~RequestScope() {
+    uint64_t micros = slash::NowMicros() - start_us_;
+    uint64_t io_micros = conn_->store_->io_micros() - io_start_;
+    conn_->metrics_->AddPhase(conn_->op_, kPhaseZpIO, io_micros);
+    conn_->metrics_->AddRequest(conn_->op_, micros);
+    if (!slow_log_->enabled()) {
+      return;
+    }
+    conn_->store_->set_trace(NULL);
+    if (micros >= slow_log_->threshold_us()) {
+      LogSlowRequest(micros, io_micros);
+    }
+  }
+
+ private:
+  ZgwConn* conn_;
+  SlowLog* slow_log_;
+  uint64_t io_start_;
+  uint64_t start_us_;
+
+  void LogSlowRequest(uint64_t micros, uint64_t io_micros) {
+    char buf[64];
+    time_t secs = start_us_ / 1000000;
+    struct tm t;
+    localtime_r(&secs, &t);
+    size_t len = strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &t);
+    snprintf(buf + len, sizeof(buf) - len, ".%06llu",
+             static_cast<unsigned long long>(start_us_ % 1000000));
+
+    std::string entry(buf);
+    entry.append(" " + conn_->request_id_ + " " + ZgwOpName(conn_->op_)
+                 + " " + conn_->ip_port() + " " + conn_->req_->method
+                 + " " + conn_->req_->path
+                 + " " + std::to_string(micros) + "us, zp "
+                 + std::to_string(io_micros) + "us in "
+                 + std::to_string(conn_->trace_.spans().size()
+                                  + conn_->trace_.dropped())
+                 + " calls\n");
+    conn_->trace_.AppendTo(&entry);
+    slow_log_->Write(entry);
+  }
+};
+
+ZgwOp ZgwConn::ParseOp() {
+  const std::string& method = req_->method;
+  const auto& params = req_->query_params;
+  if (bucket_name_.empty()) {
+    return method == "GET" ? kOpListBuckets : kOpUnknown;
+  }
+  if (IsValidBucket()) {
+    if (method == "GET") {
+      if (params.count("uploads")) {
+        return kOpListMultipartUploads;
+      } else if (params.count("location")) {
+        return kOpGetBucketLocation;
+      }
+      return kOpListObjects;
+    } else if (method == "PUT") {
+      return kOpPutBucket;
+    } else if (method == "DELETE") {
+      return kOpDelBucket;
+    } else if (method == "HEAD") {
+      return kOpHeadBucket;
+    } else if (method == "POST" && params.count("delete")) {
+      return kOpDelMultiObjects;
+    }
+  } else if (IsValidObject()) {
+    if (method == "GET") {
+      return params.count("uploadId") ? kOpListParts : kOpGetObject;
+    } else if (method == "PUT") {
+      if (params.count("partNumber") && params.count("uploadId")) {
+        return kOpUploadPart;
+      }
+      return kOpPutObject;
+    } else if (method == "DELETE") {
+      return params.count("uploadId") ? kOpAbortMultipartUpload : kOpDelObject;
+    } else if (method == "HEAD") {
+      return kOpHeadObject;
+    } else if (method == "POST") {
+      if (params.count("uploads")) {
+        return kOpInitMultipartUpload;
+      } else if (params.count("uploadId")) {
+        return kOpCompleteMultipartUpload;
+      }
+    }
+  }
+  return kOpUnknown;
+}
+
 void ZgwConn::DealMessage(const pink::HttpRequest* req, pink::HttpResponse* resp) {
-  Timer t("DealMessage " + ip_port() + ":");
   // DumpHttpRequest(req);
-  g_zgw_server->AddQueryNum();
-
   // Copy req and resp
   req_ = const_cast<pink::HttpRequest *>(req);
   resp_ = resp;
 
+  op_ = kOpUnknown;
+  request_id_ = g_zgw_server->NewRequestId();
+  resp_->SetHeaders("x-amz-request-id", request_id_);
+  RequestScope scope(this);
+
   // Get bucket name and object name
   if (req_->path[0] != '/') {
     resp_->SetStatusCode(500);
@@ -66,11 +181,12 @@ void ZgwConn::DealMessage(const pink::HttpRequest* req, pink::HttpResponse* resp
 
   ExtraBucketAndObject(req_->path, &bucket_name_, &object_name_);
   PreProcessUrl();
+  op_ = ParseOp();
 
   Status s;
   // Get access key from request and secret key from zp
   {
-  Timer t("Authorization" + ip_port() + ":");
+  PhaseTimer t(metrics_, &op_, kPhaseAuth);
   ZgwAuth zgw_auth;
   if (!zgw_auth.ParseAuthInfo(req_, &access_key_) ||
       !store_->GetUser(access_key_, &zgw_user_).ok()) {
@@ -89,133 +205,72 @@ void ZgwConn::DealMessage(const pink::HttpRequest* req, pink::HttpResponse* resp
     return;
   }
   DLOG(INFO) << "Auth passed: " << ip_port() << " " << req_->headers["authorization"];
+  streaming_payload_ = zgw_auth.is_streaming_payload();
+  if (streaming_payload_) {
+    zgw_auth.InitChunkDecoder(zgw_user_->secret_key(access_key_), &chunk_decoder_);
+  }
   }
 
   // Get buckets namelist and ref
+  objects_name_ = NULL;
   {
-  Timer t("Ref Bucket listname: ");
+  PhaseTimer t(metrics_, &op_, kPhaseNameListRef);
   s = g_zgw_server->RefAndGetBucketList(store_, access_key_, &buckets_name_);
   if (!s.ok()) {
     resp_->SetStatusCode(500);
     LOG(ERROR) << "List buckets name list failed: " << s.ToString();
     return;
   }
-  }
 
-  if (!bucket_name_.empty() && buckets_name_->IsExist(bucket_name_)) {
-    Timer t("Ref Object listname: ");
+  if (!bucket_name_.empty() && buckets_name_->IsExist(store_, bucket_name_)) {
     // Get objects namelist and ref
     s = g_zgw_server->RefAndGetObjectList(store_, bucket_name_, &objects_name_);
     if (!s.ok()) {
       resp_->SetStatusCode(500);
       LOG(ERROR) << "List objects name list failed: " << s.ToString();
+      objects_name_ = NULL;
       s = g_zgw_server->UnrefBucketList(store_, access_key_);
       return;
     }
   }
-
-  METHOD method;
-  if (req_->method == "GET") {
-    method = kGet;
-  } else if (req_->method == "PUT") {
-    method = kPut;
-  } else if (req_->method == "DELETE") {
-    method = kDelete;
-  } else if (req_->method == "HEAD") {
-    method = kHead;
-  } else if (req_->method == "POST") {
-    method = kPost;
-  } else {
-    method = kUnsupport;
   }
 
-  if (bucket_name_.empty()) {
-    if (method == kGet) {
-      ListBucketHandle();
-    } else {
-      // Unknow request
-      resp_->SetStatusCode(405);
-      resp_->SetBody(ErrorXml(MethodNotAllowed));
-    }
-  } else if (IsValidBucket()) {
-    switch(method) {
-      case kGet:
-        if (req_->query_params.count("uploads")) {
-          ListMultiPartsUpload();
-        } else if (req_->query_params.count("location")) {
-          GetBucketLocationHandle();
-        } else {
-          ListObjectHandle();
-        }
-        break;
-      case kPut:
-        PutBucketHandle();
-        break;
-      case kDelete:
-        DelBucketHandle();
-        break;
-      case kHead:
-        if (!buckets_name_->IsExist(bucket_name_)) {
-          resp_->SetStatusCode(404);
-        } else {
-          resp_->SetStatusCode(200);
-        }
-        break;
-      case kPost:
-        if (req_->query_params.find("delete") != req_->query_params.end()) {
-          DelMultiObjectsHandle();
-        }
-        break;
-      default:
-        break;
-    }
+  if (bucket_name_.empty() && op_ != kOpListBuckets) {
+    // Unknow request
+    resp_->SetStatusCode(405);
+    resp_->SetBody(ErrorXml(MethodNotAllowed));
   } else if (IsValidObject()) {
     // Check whether bucket existed in namelist meta
-    if (!buckets_name_->IsExist(bucket_name_)) {
+    if (!buckets_name_->IsExist(store_, bucket_name_)) {
       resp_->SetStatusCode(404);
       resp_->SetBody(ErrorXml(NoSuchBucket, bucket_name_));
     } else {
       DLOG(INFO) << "Object Op: " << req_->path << " confirm bucket exist";
-      g_zgw_server->ObjectLock(bucket_name_ + object_name_);
-      switch(method) {
-        case kGet:
-          if (req_->query_params.find("uploadId") != req_->query_params.end()) {
-            ListParts(req_->query_params["uploadId"]);
-          } else {
-            GetObjectHandle();
-          }
-          break;
-        case kPut:
-          if (req_->query_params.find("partNumber") != req_->query_params.end() &&
-              req_->query_params.find("uploadId") != req_->query_params.end()) {
-            UploadPartHandle(req_->query_params["partNumber"],
-                             req_->query_params["uploadId"]);
-          } else {
-            PutObjectHandle();
-          }
-          break;
-        case kDelete:
-          if (req_->query_params.find("uploadId") != req_->query_params.end()) {
-            AbortMultiUpload(req_->query_params["uploadId"]);
-          } else {
-            DelObjectHandle();
-          }
-          break;
-        case kHead:
-          GetObjectHandle(true);
-          break;
-        case kPost:
-          if (req_->query_params.find("uploads") != req_->query_params.end()) {
-            InitialMultiUpload();
-          } else if (req_->query_params.find("uploadId") != req_->query_params.end()) {
-            CompleteMultiUpload(req_->query_params["uploadId"]);
-          }
-          break;
-        default:
-          break;
+      // A copy also locks its source, whose strips are reclaimed as soon
+      // as it is overwritten or deleted. Locks are taken in key order
+      std::vector<std::string> lock_keys(1, bucket_name_ + object_name_);
+      auto source = req_->headers.find("x-amz-copy-source");
+      if (source != req_->headers.end() && !source->second.empty()) {
+        std::string src_bucket_name, src_object_name;
+        ExtraBucketAndObject(source->second, &src_bucket_name, &src_object_name);
+        if (src_bucket_name + src_object_name != lock_keys[0]) {
+          lock_keys.push_back(src_bucket_name + src_object_name);
+          std::sort(lock_keys.begin(), lock_keys.end());
+        }
+      }
+      {
+      PhaseTimer t(metrics_, &op_, kPhaseObjectLock);
+      for (auto& key : lock_keys) {
+        g_zgw_server->ObjectLock(key);
+      }
+      }
+      Dispatch();
+      for (auto key = lock_keys.rbegin(); key != lock_keys.rend(); ++key) {
+        g_zgw_server->ObjectUnlock(*key);
       }
-      g_zgw_server->ObjectUnlock(bucket_name_ + object_name_);
     }
+  } else if (bucket_name_.empty() || IsValidBucket()) {
+    Dispatch();
   } else {
     // Unknow request
     resp_->SetStatusCode(501);
@@ -224,11 +279,13 @@ void ZgwConn::DealMessage(const pink::HttpRequest* req, pink::HttpResponse* resp
 
   // Unref namelist
   {
-  Timer t("Unref namelist: ");
+  PhaseTimer t(metrics_, &op_, kPhaseNameListUnref);
   Status s1 = Status::OK();
   s = g_zgw_server->UnrefBucketList(store_, access_key_);
-  if (!bucket_name_.empty()) {
+  if (objects_name_ != NULL) {
+    // Only a bucket of the requester's own had its list referenced
     s1 = g_zgw_server->UnrefObjectList(store_, bucket_name_);
+    objects_name_ = NULL;
   }
   if (!s.ok() || !s1.ok()) {
     resp_->SetStatusCode(500);
@@ -238,7 +295,69 @@ void ZgwConn::DealMessage(const pink::HttpRequest* req, pink::HttpResponse* resp
   }
 
   resp_->SetHeaders("Date", http_nowtime(time(NULL)));
-  resp_->SetHeaders("x-amz-request-id", "tx00000000000000000113c-0058a43a07-7deaf-sh-bt-1"); // TODO (gaodq)
+}
+
+void ZgwConn::Dispatch() {
+  switch (op_) {
+    case kOpListBuckets:
+      ListBucketHandle();
+      break;
+    case kOpPutBucket:
+      PutBucketHandle();
+      break;
+    case kOpDelBucket:
+      DelBucketHandle();
+      break;
+    case kOpHeadBucket:
+      if (!buckets_name_->IsExist(store_, bucket_name_)) {
+        resp_->SetStatusCode(404);
+      } else {
+        resp_->SetStatusCode(200);
+      }
+      break;
+    case kOpGetBucketLocation:
+      GetBucketLocationHandle();
+      break;
+    case kOpListObjects:
+      ListObjectHandle();
+      break;
+    case kOpListMultipartUploads:
+      ListMultiPartsUpload();
+      break;
+    case kOpDelMultiObjects:
+      DelMultiObjectsHandle();
+      break;
+    case kOpGetObject:
+      GetObjectHandle();
+      break;
+    case kOpHeadObject:
+      GetObjectHandle(true);
+      break;
+    case kOpPutObject:
+      PutObjectHandle();
+      break;
+    case kOpDelObject:
+      DelObjectHandle();
+      break;
+    case kOpInitMultipartUpload:
+      InitialMultiUpload();
+      break;
+    case kOpUploadPart:
+      UploadPartHandle(req_->query_params["partNumber"],
+                       req_->query_params["uploadId"]);
+      break;
+    case kOpCompleteMultipartUpload:
+      CompleteMultiUpload(req_->query_params["uploadId"]);
+      break;
+    case kOpAbortMultipartUpload:
+      AbortMultiUpload(req_->query_params["uploadId"]);
+      break;
+    case kOpListParts:
+      ListParts(req_->query_params["uploadId"]);
+      break;
+    default:
+      break;
+  }
 }
 
 void ZgwConn::InitialMultiUpload() {
@@ -260,7 +379,19 @@ void ZgwConn::InitialMultiUpload() {
   DLOG(INFO) << "Get upload id, and insert multiupload meta to zp";
 
   // Insert into namelist
-  objects_name_->Insert(internal_obname);
+  s = objects_name_->Insert(store_, internal_obname);
+  if (!s.ok()) {
+    resp_->SetStatusCode(500);
+    LOG(ERROR) << "InitialMultiUpload: insert into namelist failed: " << s.ToString();
+    return;
+  }
+  s = objects_name_->Insert(store_,
+                            libzgw::UploadIndexName(object_name_, upload_id));
+  if (!s.ok()) {
+    resp_->SetStatusCode(500);
+    LOG(ERROR) << "InitialMultiUpload: insert into upload index failed: " << s.ToString();
+    return;
+  }
   DLOG(INFO) << "Insert into namelist: " << internal_obname;
 
   // Success Response
@@ -271,7 +402,7 @@ void ZgwConn::InitialMultiUpload() {
 
 void ZgwConn::UploadPartHandle(const std::string& part_num, const std::string& upload_id) {
   std::string internal_obname = libzgw::kInternalObjectNamePrefix + object_name_ + upload_id;
-  if (!objects_name_->IsExist(internal_obname)) {
+  if (!objects_name_->IsExist(store_, internal_obname)) {
     resp_->SetStatusCode(404);
     resp_->SetBody(ErrorXml(NoSuchUpload, upload_id));
     return;
@@ -281,36 +412,42 @@ void ZgwConn::UploadPartHandle(const std::string& part_num, const std::string& u
   timeval now;
   gettimeofday(&now, NULL);
   // Handle copy operation
-  std::string src_bucket_name, src_object_name, etag;
   bool is_copy_op = !req_->headers["x-amz-copy-source"].empty();
-  std::string object_content;
+  libzgw::ZgwObject src_object("", "");
+  uint64_t copy_offset = 0, copy_size = 0;
   if (is_copy_op) {
-    Timer t("UploadPart: GetSourceObject");
-    bool res = GetSourceObject(&object_content);
-    DLOG(INFO) << "UploadPart: " << "SourceObject Size: " << object_content.size();
+    bool res = GetSourceObject(&src_object, &copy_offset, &copy_size);
+    DLOG(INFO) << "UploadPart: " << "SourceObject Size: " << copy_size;
     if (!res) {
       return;
     }
   } else {
-    object_content = req_->content;
-    DLOG(INFO) << "UploadPart: " << "Part Size: " << object_content.size();
+    DLOG(INFO) << "UploadPart: " << "Part Size: " << req_->content.size();
   }
-  {
-  Timer t("UploadPart: Calc md5");
-  etag.assign("\"" + md5(object_content) + "\"");
-  }
-  libzgw::ZgwObjectInfo ob_info(now, etag, object_content.size(), libzgw::kStandard,
+  int part_number = std::atoi(part_num.c_str());
+  libzgw::ZgwObjectInfo ob_info(now, "", 0, libzgw::kStandard,
                                 zgw_user_->user_info());
-  {
-  Timer t("UploadPart: UploadPart to zp");
-  s = store_->UploadPart(bucket_name_, internal_obname, ob_info, object_content,
-                         std::atoi(part_num.c_str()));
+  libzgw::ZgwObjectWriter writer(store_, bucket_name_,
+                                 libzgw::SubObjectName(internal_obname, part_number),
+                                 ob_info,
+                                 is_copy_op ? copy_size : RequestBodySize());
+  if (is_copy_op) {
+    if (!CopySourceObject(src_object, copy_offset, copy_size, &writer)) {
+      return;
+    }
+  } else if (!AppendRequestBody(&writer)) {
+    return;
+  }
+  s = writer.Finish();
+  if (s.ok()) {
+    s = store_->UploadPart(bucket_name_, internal_obname, part_number);
   }
   if (!s.ok()) {
     resp_->SetStatusCode(500);
     LOG(ERROR) << "UploadPart data failed: " << s.ToString();
     return;
   }
+  const std::string& etag = writer.object().info().etag;
   DLOG(INFO) << "UploadPart: " << req_->path << " confirm add to zp success";
 
   if (is_copy_op) {
@@ -323,7 +460,7 @@ void ZgwConn::UploadPartHandle(const std::string& part_num, const std::string& u
 void ZgwConn::CompleteMultiUpload(const std::string& upload_id) {
   Status s;
   std::string internal_obname = libzgw::kInternalObjectNamePrefix + object_name_ + upload_id;
-  if (!objects_name_->IsExist(internal_obname)) {
+  if (!objects_name_->IsExist(store_, internal_obname)) {
     resp_->SetStatusCode(404);
     resp_->SetBody(ErrorXml(NoSuchUpload, upload_id));
     return;
@@ -339,10 +476,7 @@ void ZgwConn::CompleteMultiUpload(const std::string& upload_id) {
     return;
   }
   std::vector<std::pair<int, libzgw::ZgwObject>> store_parts;
-  {
-  Timer t("CompleteMultiUpload: ListParts");
   s = store_->ListParts(bucket_name_, internal_obname, &store_parts);
-  }
   if (!s.ok()) {
     resp_->SetStatusCode(500);
     LOG(ERROR) << "CompleteMultiUpload failed in list object parts: " << s.ToString();
@@ -378,7 +512,7 @@ void ZgwConn::CompleteMultiUpload(const std::string& upload_id) {
   }
 
   // Delete old object data
-  if (objects_name_->IsExist(object_name_)) {
+  if (objects_name_->IsExist(store_, object_name_)) {
     s = store_->DelObject(bucket_name_, object_name_);
     if (!s.ok() && !s.IsNotFound()) {
       resp_->SetStatusCode(500);
@@ -390,10 +524,7 @@ void ZgwConn::CompleteMultiUpload(const std::string& upload_id) {
 
   // Update object meta in zp
   std::string final_etag;
-  {
-  Timer t("CompleteMultiUpload: CompleteMultiUpload to zp");
   s = store_->CompleteMultiUpload(bucket_name_, internal_obname, store_parts, &final_etag);
-  }
   if (!s.ok()) {
     resp_->SetStatusCode(500);
     LOG(ERROR) << "CompleteMultiUpload failed: " << s.ToString();
@@ -401,8 +532,19 @@ void ZgwConn::CompleteMultiUpload(const std::string& upload_id) {
   }
   DLOG(INFO) << "CompleteMultiUpload: " << req_->path << " confirm zp's objects change name";
 
-  objects_name_->Insert(object_name_);
-  objects_name_->Delete(internal_obname);
+  s = objects_name_->Insert(store_, object_name_);
+  if (s.ok()) {
+    s = objects_name_->Delete(store_, internal_obname);
+  }
+  if (s.ok()) {
+    s = objects_name_->Delete(store_,
+                              libzgw::UploadIndexName(object_name_, upload_id));
+  }
+  if (!s.ok()) {
+    resp_->SetStatusCode(500);
+    LOG(ERROR) << "CompleteMultiUpload: update namelist failed: " << s.ToString();
+    return;
+  }
 
   resp_->SetStatusCode(200);
   final_etag.erase(final_etag.size() - 1); // erase last '"'
@@ -415,7 +557,7 @@ void ZgwConn::CompleteMultiUpload(const std::string& upload_id) {
 
 void ZgwConn::AbortMultiUpload(const std::string& upload_id) {
   std::string internal_obname = libzgw::kInternalObjectNamePrefix + object_name_ + upload_id;
-  if (!objects_name_->IsExist(internal_obname)) {
+  if (!objects_name_->IsExist(store_, internal_obname)) {
     resp_->SetStatusCode(404);
     resp_->SetBody(ErrorXml(NoSuchUpload, upload_id));
     return;
@@ -432,7 +574,16 @@ void ZgwConn::AbortMultiUpload(const std::string& upload_id) {
     }
   }
 
-  objects_name_->Delete(internal_obname);
+  s = objects_name_->Delete(store_, internal_obname);
+  if (s.ok()) {
+    s = objects_name_->Delete(store_,
+                              libzgw::UploadIndexName(object_name_, upload_id));
+  }
+  if (!s.ok()) {
+    resp_->SetStatusCode(500);
+    LOG(ERROR) << "AbortMultiUpload: delete from namelist failed: " << s.ToString();
+    return;
+  }
   DLOG(INFO) << "AbortMultiUpload: " << req_->path << " confirm delete object meta from namelist success";
 
   // Success
@@ -442,7 +593,7 @@ void ZgwConn::AbortMultiUpload(const std::string& upload_id) {
 void ZgwConn::ListParts(const std::string& upload_id) {
   Status s;
   std::string internal_obname = libzgw::kInternalObjectNamePrefix + object_name_ + upload_id;
-  if (!objects_name_->IsExist(internal_obname)) {
+  if (!objects_name_->IsExist(store_, internal_obname)) {
     resp_->SetStatusCode(404);
     resp_->SetBody(ErrorXml(NoSuchUpload, upload_id));
     return;
@@ -464,10 +615,7 @@ void ZgwConn::ListParts(const std::string& upload_id) {
   }
   bool is_trucated = false;
   std::vector<std::pair<int, libzgw::ZgwObject>> parts, needed_parts;
-  {
-  Timer t("ListParts: ListParts from zp");
   s = store_->ListParts(bucket_name_, internal_obname, &parts);
-  }
   if (!s.ok()) {
     resp_->SetStatusCode(500);
     LOG(ERROR) << "ListParts failed: " << s.ToString();
@@ -499,12 +647,13 @@ void ZgwConn::ListParts(const std::string& upload_id) {
     {"IsTruncated", is_trucated ? "true" : "false"},
   };
   resp_->SetStatusCode(200);
+  PhaseTimer t(metrics_, &op_, kPhaseXml);
   resp_->SetBody(ListPartsResultXml(needed_parts, zgw_user_->user_info(), args));
 }
 
 void ZgwConn::ListMultiPartsUpload() {
   // Check whether bucket existed in namelist meta
-  if (!buckets_name_->IsExist(bucket_name_)) {
+  if (!buckets_name_->IsExist(store_, bucket_name_)) {
     resp_->SetStatusCode(404);
     resp_->SetBody(ErrorXml(NoSuchBucket, bucket_name_));
     return;
@@ -533,82 +682,95 @@ void ZgwConn::ListMultiPartsUpload() {
   std::string key_marker = req_->query_params["key-marker"];
   std::string upload_id_marker = req_->query_params["upload-id-marker"];
 
+  Status s = IndexUploads();
+  if (!s.ok()) {
+    resp_->SetStatusCode(500);
+    LOG(ERROR) << "ListMultiPartsUpload: index uploads failed: " << s.ToString();
+    return;
+  }
+
+  // Walk the upload index in key, upload id order from the marker, whole
+  // common prefix ranges are skipped, stop after max uploads
+  const std::string& index_prefix = libzgw::kInternalUploadIndexPrefix;
+  std::string range = index_prefix + prefix;
+  std::string seek = range;
+  bool more = true;
+  if (!key_marker.empty()) {
+    // Entries of key marker go on with '\0' + upload id, those of longer
+    // keys with at least '\1'
+    std::string from = index_prefix + key_marker;
+    from += upload_id_marker.empty() ? std::string(1, '\1') :
+      '\0' + upload_id_marker + '\0';
+    if (!delimiter.empty() && upload_id_marker.empty() &&
+        key_marker.size() > prefix.size() &&
+        key_marker.back() == delimiter[0]) {
+      // A common prefix marker excludes every key it prefixes
+      more = PrefixSuccessor(index_prefix + key_marker, &from);
+    }
+    seek = std::max(seek, from);
+  }
+
   bool is_trucated = false;
-  Status s;
   std::set<std::string> commonprefixes;
   std::vector<std::string> candidate_names;
   std::vector<libzgw::ZgwObject> objects;
-  {
-    std::lock_guard<std::mutex> lock(objects_name_->list_lock);
-    for (auto &name : objects_name_->name_list) {
-      if (name.compare(0, 2, libzgw::kInternalObjectNamePrefix) != 0) {
-        // Skip ordinary object
-        continue;
-      }
-      if (!prefix.empty() &&
-          name.substr(2, std::min(name.size(), prefix.size())) != prefix) {
-        // Skip prefix
-        continue;
-      }
-      size_t marker_size = 2 + key_marker.size() + upload_id_marker.size();
-      if (!key_marker.empty() &&
-          !upload_id_marker.empty() &&
-          name.substr(0, std::min(name.size(), marker_size)) <=
-          ("__" + key_marker + upload_id_marker)) {
-        continue;
-      }
-      if (!delimiter.empty()) {
-        size_t pos = name.find_first_of(delimiter, 2 + prefix.size());
-        if (pos != std::string::npos) {
-          commonprefixes.insert(name.substr(2, std::min(name.size(),
-                                                        pos - 2 + 1)));
-          continue;
-        }
+  std::string name, key, upload_id, entry;
+  std::string next_key_marker, next_upload_id_marker;
+  int upload_count = 0;
+  while (more) {
+    s = objects_name_->LowerBound(store_, seek, &name);
+    if (!s.ok()) {
+      break;
+    }
+    if (name.compare(0, range.size(), range) != 0) {
+      // Past the prefix range
+      break;
+    }
+    seek = name + '\0';
+    if (!libzgw::ParseUploadIndexName(name, &key, &upload_id)) {
+      continue;
+    }
+    std::string internal_obname = libzgw::kInternalObjectNamePrefix + key + upload_id;
+    if (!objects_name_->IsExist(store_, internal_obname)) {
+      // Left behind by a failed complete or abort
+      continue;
+    }
+    bool is_commonprefix = false;
+    entry = key;
+    if (!delimiter.empty()) {
+      size_t pos = key.find(delimiter[0], prefix.size());
+      if (pos != std::string::npos) {
+        entry = key.substr(0, pos + 1);
+        is_commonprefix = true;
       }
-
-      candidate_names.push_back(name);
     }
-  }
+    if (upload_count >= max_uploads) {
+      // Is not trucated if max uploads equal zero
+      is_trucated = max_uploads > 0;
+      break;
+    }
 
-  int diff = commonprefixes.size() + candidate_names.size()
-    - static_cast<size_t>(max_uploads);
-  is_trucated = diff > 0;
-  if (is_trucated) {
-    size_t extra_num = diff;
-    if (commonprefixes.size() >= extra_num) {
-      for (auto it = commonprefixes.rbegin();
-           it != commonprefixes.rend() && extra_num--;) {
-        commonprefixes.erase(*(it++));
-      }
+    ++upload_count;
+    next_key_marker = entry;
+    if (is_commonprefix) {
+      commonprefixes.insert(entry);
+      next_upload_id_marker.clear();
+      more = PrefixSuccessor(index_prefix + entry, &seek);
     } else {
-      extra_num -= commonprefixes.size();
-      commonprefixes.clear();
-      if (candidate_names.size() <= extra_num) {
-        candidate_names.clear();
-      } else {
-        while (extra_num--)
-          candidate_names.pop_back();
-      }
+      candidate_names.push_back(internal_obname);
+      next_upload_id_marker = upload_id;
     }
   }
-
-  is_trucated = is_trucated && max_uploads > 0;
-  std::string next_key_marker;
-  if (is_trucated) {
-    if (!commonprefixes.empty()) {
-      next_key_marker = *commonprefixes.rbegin();
-    } else if (!candidate_names.empty()) {
-      next_key_marker = candidate_names.back();
-      size_t marker_size = next_key_marker.size() - 32 -2;
-      next_key_marker =
-        next_key_marker.substr(2, std::min(next_key_marker.size(), marker_size));
-    }
+  if (!s.ok() && !s.IsNotFound()) {
+    resp_->SetStatusCode(500);
+    LOG(ERROR) << "Scan objects name list failed: " << s.ToString();
+    return;
+  }
+  if (!is_trucated) {
+    next_key_marker.clear();
   }
 
-  {
-  Timer t("ListObjects: ListObjects from zp");
   s = store_->ListObjects(bucket_name_, candidate_names, &objects);
-  }
   if (!s.ok()) {
     resp_->SetStatusCode(500);
     LOG(ERROR) << "ListMultiPartsUpload failed: " << s.ToString();
@@ -626,18 +788,57 @@ void ZgwConn::ListMultiPartsUpload() {
 
   if (!next_key_marker.empty()) {
     args.insert(std::make_pair("NextKeyMarker", next_key_marker));
-    std::string upload_id;
-    if (is_trucated && !objects.empty()) {
-      upload_id = objects.back().upload_id();
-    }
-    args.insert(std::make_pair("NextUploadIdMarker", upload_id));
+    args.insert(std::make_pair("NextUploadIdMarker", next_upload_id_marker));
   }
   resp_->SetStatusCode(200);
+  PhaseTimer t(metrics_, &op_, kPhaseXml);
   resp_->SetBody(ListMultipartUploadsResultXml(objects, args, commonprefixes));
 }
 
+Status ZgwConn::IndexUploads() {
+  const std::string& index_prefix = libzgw::kInternalUploadIndexPrefix;
+  if (objects_name_->IsExist(store_, index_prefix)) {
+    return Status::OK();
+  }
+
+  // Uploads started before the index, named "__" + key + upload id
+  const std::string& internal_prefix = libzgw::kInternalObjectNamePrefix;
+  std::vector<std::string> index_names;
+  std::string seek = internal_prefix, name;
+  Status s;
+  while ((s = objects_name_->LowerBound(store_, seek, &name)).ok()) {
+    if (name.compare(0, internal_prefix.size(), internal_prefix) != 0) {
+      break;
+    }
+    if (name.compare(0, index_prefix.size(), index_prefix) == 0) {
+      if (!PrefixSuccessor(index_prefix, &seek)) {
+        break;
+      }
+      continue;
+    }
+    seek = name + '\0';
+    if (name.size() < internal_prefix.size() + libzgw::kUploadIdSize) {
+      continue;
+    }
+    size_t key_end = name.size() - libzgw::kUploadIdSize;
+    index_names.push_back(libzgw::UploadIndexName(
+          name.substr(internal_prefix.size(), key_end - internal_prefix.size()),
+          name.substr(key_end)));
+  }
+  if (!s.ok() && !s.IsNotFound()) {
+    return s;
+  }
+  for (auto& index_name : index_names) {
+    s = objects_name_->Insert(store_, index_name);
+    if (!s.ok()) {
+      return s;
+    }
+  }
+  return objects_name_->Insert(store_, index_prefix);
+}
+
 void ZgwConn::DelMultiObjectsHandle() {
-  if (!buckets_name_->IsExist(bucket_name_)) {
+  if (!buckets_name_->IsExist(store_, bucket_name_)) {
     resp_->SetStatusCode(404);
     resp_->SetBody(ErrorXml(NoSuchBucket, bucket_name_));
     return;
@@ -653,16 +854,21 @@ void ZgwConn::DelMultiObjectsHandle() {
   Status s;
   for (auto &key : keys) {
     DLOG(INFO) << "DeleteMuitiObjects: " << key;
-    if (objects_name_->IsExist(key)) {
+    if (objects_name_->IsExist(store_, key)) {
       s = store_->DelObject(bucket_name_, key);
       if (!s.ok()) {
         error_keys.insert(std::make_pair(key, "InternalError"));
         continue;
       }
     }
-    objects_name_->Delete(key);
+    s = objects_name_->Delete(store_, key);
+    if (!s.ok()) {
+      error_keys.insert(std::make_pair(key, "InternalError"));
+      continue;
+    }
     success_keys.push_back(key);
   }
+  PhaseTimer t(metrics_, &op_, kPhaseXml);
   resp_->SetBody(DeleteResultXml(success_keys, error_keys));
   resp_->SetStatusCode(200);
 }
@@ -671,7 +877,7 @@ void ZgwConn::DelObjectHandle() {
   DLOG(INFO) << "DeleteObject: " << bucket_name_ << "/" << object_name_;
 
   // Check whether object existed in namelist meta
-  if (!objects_name_->IsExist(object_name_)) {
+  if (!objects_name_->IsExist(store_, object_name_)) {
     resp_->SetStatusCode(204);
     return;
   }
@@ -691,7 +897,12 @@ void ZgwConn::DelObjectHandle() {
   DLOG(INFO) << "DelObject: " << req_->path << " confirm delete object from zp success";
 
   // Delete from list meta
-  objects_name_->Delete(object_name_);
+  s = objects_name_->Delete(store_, object_name_);
+  if (!s.ok()) {
+    resp_->SetStatusCode(500);
+    LOG(ERROR) << "Delete object from namelist failed: " << s.ToString();
+    return;
+  }
 
   DLOG(INFO) << "DelObject: " << req_->path << " confirm delete object meta from namelist success";
 
@@ -699,31 +910,201 @@ void ZgwConn::DelObjectHandle() {
   resp_->SetStatusCode(204);
 }
 
+// Range headers with more ranges than this are ignored, as are those
+// asking for more bytes in total than the object has
+static const size_t kMaxRanges = 256;
+
 bool ZgwConn::ParseRange(const std::string& range,
-                         std::vector<std::pair<int, uint32_t>>* segments) {
+                         std::vector<std::pair<int64_t, uint64_t>>* segments) {
   // Check whether range is valid
-  size_t pos = range.find("bytes=");
-  if (pos == std::string::npos) {
+  if (range.compare(0, 6, "bytes=") != 0) {
     resp_->SetStatusCode(400);
     resp_->SetBody(ErrorXml(InvalidArgument, "range"));
     return false;
   }
-  std::string range_header = range.substr(6);
+  // first-last, first- or -suffix_length, comma separated
   std::vector<std::string> elems;
-  slash::StringSplit(range_header, ',', elems);
+  slash::StringSplit(range.substr(6), ',', elems);
   for (auto& elem : elems) {
-    int start = 0;
-    uint32_t end = UINT32_MAX;
-    int res = sscanf(elem.c_str(), "%d-%d", &start, &end);
-    if (res > 0) {
-      if (start > 0 && end < static_cast<uint32_t>(start)) {
-        resp_->SetStatusCode(416);
-        resp_->SetBody(ErrorXml(InvalidRange, bucket_name_));
-        return false;
+    const char* p = elem.c_str();
+    char* end = NULL;
+    while (*p == ' ') {
+      p++;
+    }
+    int64_t first = 0;
+    uint64_t last = UINT64_MAX;
+    if (*p == '-' && isdigit(p[1])) {
+      uint64_t suffix = strtoull(p + 1, &end, 10);
+      // -0 is in no object
+      first = suffix == 0 ? INT64_MAX
+        : -static_cast<int64_t>(std::min(suffix, static_cast<uint64_t>(INT64_MAX)));
+    } else if (isdigit(*p)) {
+      first = strtoll(p, &end, 10);
+      if (*end != '-') {
+        end = NULL;
+      } else if (isdigit(end[1])) {
+        last = strtoull(end + 1, &end, 10);
+      } else {
+        end++;
       }
-      segments->push_back(std::make_pair(start, end));
-      break; // Support one range for now
     }
+    while (end != NULL && *end == ' ') {
+      end++;
+    }
+    if (end == NULL || *end != '\0') {
+      // An invalid range header is ignored as a whole
+      segments->clear();
+      return true;
+    }
+    if (first >= 0 && last < static_cast<uint64_t>(first)) {
+      resp_->SetStatusCode(416);
+      resp_->SetBody(ErrorXml(InvalidRange, bucket_name_));
+      return false;
+    }
+    segments->push_back(std::make_pair(first, last));
+  }
+  if (segments->size() > kMaxRanges) {
+    segments->clear();
+  }
+  return true;
+}
+
+static std::string ContentRange(uint64_t offset, uint64_t length,
+                                uint64_t size) {
+  char buf[80];
+  snprintf(buf, sizeof(buf), "bytes %llu-%llu/%llu",
+           static_cast<unsigned long long>(offset),
+           static_cast<unsigned long long>(offset + length - 1),
+           static_cast<unsigned long long>(size));
+  return buf;
+}
+
+Status ZgwConn::ReadRanges(const libzgw::ZgwObject& object,
+                           const std::vector<std::pair<uint64_t, uint64_t>>& ranges,
+                           const std::string& boundary, std::string* body) {
+  uint64_t total = 0;
+  for (auto& r : ranges) {
+    total += r.second;
+  }
+  body->reserve(total + (boundary.empty() ? 0 : ranges.size() * 128));
+
+  Status s;
+  std::string piece;
+  size_t piece_pos = 0;
+  size_t i = 0;
+  while (i < ranges.size()) {
+    // Ranges ascending with gaps below a strip share one reader
+    uint64_t begin = ranges[i].first;
+    uint64_t end = begin + ranges[i].second;
+    size_t group_end = i + 1;
+    while (group_end < ranges.size() && ranges[group_end].first >= end &&
+           ranges[group_end].first - end < object.strip_len()) {
+      end = ranges[group_end].first + ranges[group_end].second;
+      group_end++;
+    }
+    libzgw::ZgwObjectReader reader(store_, object, begin, end - begin);
+    piece.clear();
+    piece_pos = 0;
+    uint64_t pos = begin;
+    for (; i < group_end; i++) {
+      if (!boundary.empty()) {
+        body->append("--" + boundary + "\r\n");
+        body->append("Content-Type: application/octet-stream\r\n");
+        body->append("Content-Range: " +
+                     ContentRange(ranges[i].first, ranges[i].second,
+                                  object.info().size) + "\r\n\r\n");
+      }
+      uint64_t skip = ranges[i].first - pos;
+      uint64_t want = ranges[i].second;
+      while (skip > 0 || want > 0) {
+        if (piece_pos == piece.size()) {
+          s = reader.Next(&piece);
+          if (s.IsEndFile()) {
+            return Status::NotFound("Data is shorter than object size");
+          } else if (!s.ok()) {
+            return s;
+          }
+          piece_pos = 0;
+        }
+        uint64_t n = std::min(static_cast<uint64_t>(piece.size() - piece_pos),
+                              skip > 0 ? skip : want);
+        if (skip > 0) {
+          skip -= n;
+        } else {
+          body->append(piece, piece_pos, n);
+          want -= n;
+        }
+        piece_pos += n;
+      }
+      pos = ranges[i].first + ranges[i].second;
+      if (!boundary.empty()) {
+        body->append("\r\n");
+      }
+    }
+  }
+  if (!boundary.empty()) {
+    body->append("--" + boundary + "--\r\n");
+  }
+  return Status::OK();
+}
+
+// Whether etag is in the comma separated entity tags of header, weak
+// tags compare by their opaque part
+static bool EtagListMatch(const std::string& header, const std::string& etag) {
+  std::string bare = etag;
+  if (bare.size() >= 2 && bare.front() == '"' && bare.back() == '"') {
+    bare = bare.substr(1, bare.size() - 2);
+  }
+  size_t pos = 0;
+  while (pos < header.size()) {
+    size_t end = header.find(',', pos);
+    if (end == std::string::npos) {
+      end = header.size();
+    }
+    std::string tag = slash::StringTrim(header.substr(pos, end - pos), " \t");
+    pos = end + 1;
+    if (tag == "*") {
+      return true;
+    }
+    if (tag.compare(0, 2, "W/") == 0) {
+      tag = tag.substr(2);
+    }
+    if (tag.size() >= 2 && tag.front() == '"' && tag.back() == '"') {
+      tag = tag.substr(1, tag.size() - 2);
+    }
+    if (tag == bare) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ZgwConn::CheckConditions(const libzgw::ZgwObjectInfo& info) {
+  // A date condition only counts without the matching etag condition
+  time_t since;
+  bool failed = false;
+  const std::string& if_match = req_->headers["if-match"];
+  if (!if_match.empty()) {
+    failed = !EtagListMatch(if_match, info.etag);
+  } else if (parse_http_time(req_->headers["if-unmodified-since"], &since)) {
+    failed = info.mtime.tv_sec > since;
+  }
+  if (failed) {
+    resp_->SetStatusCode(412);
+    resp_->SetBody(ErrorXml(PreconditionFailed));
+    return false;
+  }
+
+  bool not_modified = false;
+  const std::string& if_none_match = req_->headers["if-none-match"];
+  if (!if_none_match.empty()) {
+    not_modified = EtagListMatch(if_none_match, info.etag);
+  } else if (parse_http_time(req_->headers["if-modified-since"], &since)) {
+    not_modified = info.mtime.tv_sec <= since;
+  }
+  if (not_modified) {
+    resp_->SetStatusCode(304);
+    return false;
   }
   return true;
 }
@@ -731,7 +1112,7 @@ bool ZgwConn::ParseRange(const std::string& range,
 void ZgwConn::GetObjectHandle(bool is_head_op) {
   DLOG(INFO) << "GetObjects: " << bucket_name_ << "/" << object_name_;
 
-  if (!objects_name_->IsExist(object_name_)) {
+  if (!objects_name_->IsExist(store_, object_name_)) {
     resp_->SetStatusCode(404);
     resp_->SetBody(ErrorXml(NoSuchKey, object_name_));
     return;
@@ -740,56 +1121,146 @@ void ZgwConn::GetObjectHandle(bool is_head_op) {
 
   // Get object
   Status s;
-  std::vector<std::pair<int, uint32_t>> segments;
-  if (!req_->headers["range"].empty() &&
+  std::vector<std::pair<int64_t, uint64_t>> segments;
+  if (!is_head_op && !req_->headers["range"].empty() &&
       !ParseRange(req_->headers["range"], &segments)) {
     return;
   }
   libzgw::ZgwObject object(bucket_name_, object_name_);
-  bool need_content = !is_head_op;
-  bool need_partial = !segments.empty();
-  if (need_partial && need_content) {
-    for (auto& seg : segments) {
-      std::cout << seg.first << " - " << seg.second << std::endl;
-    }
-    Timer t("GetObject: GetPartialObject");
-    s = store_->GetPartialObject(&object, segments);
-  } else {
-    Timer t("GetObject: ");
-    s = store_->GetObject(&object, need_content);
+  s = store_->GetCachedObject(&object);
+  if (s.IsNotFound()) {
+    resp_->SetStatusCode(404);
+    resp_->SetBody(ErrorXml(NoSuchKey, object_name_));
+    return;
+  } else if (!s.ok()) {
+    resp_->SetStatusCode(500);
+    LOG(ERROR) << "Get object meta failed: " << s.ToString();
+    return;
   }
+  uint64_t size = object.info().size;
+  resp_->SetHeaders("Last-Modified", http_nowtime(object.info().mtime.tv_sec));
+  resp_->SetHeaders("ETag", object.info().etag);
+  if (!CheckConditions(object.info())) {
+    return;
+  }
+
+  // offset : length of the satisfiable ranges, in request order
+  std::vector<std::pair<uint64_t, uint64_t>> ranges;
+  uint64_t range_bytes = 0;
+  for (auto& seg : segments) {
+    uint64_t offset, length;
+    if (libzgw::ResolveByteRange(seg.first, seg.second, size, &offset, &length)) {
+      ranges.push_back(std::make_pair(offset, length));
+      range_bytes += length;
+    }
+  }
+  if (!segments.empty() && ranges.empty()) {
+    resp_->SetStatusCode(416);
+    resp_->SetHeaders("Content-Range", "bytes */" + std::to_string(size));
+    resp_->SetBody(ErrorXml(InvalidRange, bucket_name_));
+    return;
+  }
+  if (range_bytes > size) {
+    // Overlapping ranges asking for more than the object, RFC 7233 6.1,
+    // are served as the whole object so the body stays bounded by it
+    ranges.clear();
+  }
+
+  if (is_head_op) {
+    resp_->SetHeaders("Content-Length", size);
+    resp_->SetStatusCode(200);
+    return;
+  }
+
+  // Pull strips one by one straight into the response body
+  std::string body, boundary;
+  if (ranges.size() > 1) {
+    boundary = md5(object.info().etag + std::to_string(slash::NowMicros()));
+  }
+  s = ReadRanges(object, ranges.empty()
+                   ? std::vector<std::pair<uint64_t, uint64_t>>{{0, size}}
+                   : ranges,
+                 boundary, &body);
   if (!s.ok()) {
     if (s.IsNotFound()) {
       LOG(WARNING) << "Data size maybe strip count error";
-    } else if (s.IsEndFile()) {
-      resp_->SetStatusCode(416);
-      resp_->SetBody(ErrorXml(InvalidRange, bucket_name_));
-      return;
-    } else {
-      resp_->SetStatusCode(500);
-      LOG(ERROR) << "Get object data failed: " << s.ToString();
-      return;
     }
+    resp_->SetStatusCode(500);
+    LOG(ERROR) << "Get object data failed: " << s.ToString();
+    return;
   }
   DLOG(INFO) << "GetObject: " << req_->path << " confirm get object from zp success";
-  DLOG(INFO) << "GetObject: " << req_->path << " Size: " << object.info().size;
+  DLOG(INFO) << "GetObject: " << req_->path << " Size: " << size;
 
-  resp_->SetHeaders("Last-Modified", http_nowtime(object.info().mtime.tv_sec));
-  resp_->SetBody(object.content());
-  resp_->SetHeaders("Content-Length", object.info().size);
-  resp_->SetHeaders("ETag", object.info().etag);
-  if (need_partial) {
-    char buf[256] = {0};
-    sprintf(buf, "bytes %d-%u/%lu", segments[0].first, segments[0].second, object.info().size);
-    resp_->SetHeaders("Content-Range", std::string(buf));
-    resp_->SetHeaders("Content-Length", object.content().size());
+  if (ranges.empty()) {
+    resp_->SetStatusCode(200);
+  } else if (ranges.size() == 1) {
+    resp_->SetHeaders("Content-Range",
+                      ContentRange(ranges[0].first, ranges[0].second, size));
     resp_->SetStatusCode(206);
   } else {
-    resp_->SetStatusCode(200);
+    resp_->SetHeaders("Content-Type",
+                      "multipart/byteranges; boundary=" + boundary);
+    resp_->SetStatusCode(206);
   }
+  resp_->SetHeaders("Content-Length", body.size());
+  resp_->SetBody(body);
+}
+
+uint64_t ZgwConn::RequestBodySize() {
+  if (streaming_payload_) {
+    // Chunk headers and signatures are not counted
+    return strtoull(req_->headers["x-amz-decoded-content-length"].c_str(),
+                    NULL, 10);
+  }
+  return req_->content.size();
+}
+
+bool ZgwConn::AppendRequestBody(libzgw::ZgwObjectWriter* writer) {
+  Status s;
+  if (!streaming_payload_) {
+    // Strips are cut straight from the request body, no whole copy is made
+    s = writer->Append(req_->content);
+    if (!s.ok()) {
+      resp_->SetStatusCode(500);
+      LOG(ERROR) << "Put object data failed: " << s.ToString();
+      return false;
+    }
+    return true;
+  }
+
+  // Chunks are verified and passed to writer one by one
+  Status ws;
+  s = chunk_decoder_.Decode(req_->content.data(), req_->content.size(),
+                            [writer, &ws](const char* data, size_t size) {
+                              ws = writer->Append(data, size);
+                              return ws;
+                            });
+  if (!ws.ok()) {
+    resp_->SetStatusCode(500);
+    LOG(ERROR) << "Put object data failed: " << ws.ToString();
+    return false;
+  }
+  if (s.IsAuthFailed()) {
+    resp_->SetStatusCode(403);
+    resp_->SetBody(ErrorXml(SignatureDoesNotMatch));
+    DLOG(INFO) << "Chunk auth failed: " << ip_port() << " " << s.ToString();
+    return false;
+  }
+  const std::string& decoded_length = req_->headers["x-amz-decoded-content-length"];
+  if (!s.ok() || !chunk_decoder_.finished() ||
+      (!decoded_length.empty() &&
+       std::to_string(chunk_decoder_.decoded_size()) != decoded_length)) {
+    resp_->SetStatusCode(400);
+    resp_->SetBody(ErrorXml(IncompleteBody));
+    DLOG(INFO) << "Bad aws-chunked body: " << ip_port() << " " << s.ToString();
+    return false;
+  }
+  return true;
 }
 
-bool ZgwConn::GetSourceObject(std::string* content) {
+bool ZgwConn::GetSourceObject(libzgw::ZgwObject* src, uint64_t* offset,
+                              uint64_t* size) {
   std::string src_bucket_name, src_object_name;
   auto& source = req_->headers.at("x-amz-copy-source");
   DLOG(INFO) << "Copy source object: " << source;
@@ -800,7 +1271,7 @@ bool ZgwConn::GetSourceObject(std::string* content) {
     resp_->SetBody(ErrorXml(InvalidArgument, "x-amz-copy-source"));
     return false;
   }
-  if (!buckets_name_->IsExist(src_bucket_name)) {
+  if (!buckets_name_->IsExist(store_, src_bucket_name)) {
     resp_->SetStatusCode(404);
     resp_->SetBody(ErrorXml(NoSuchBucket, src_bucket_name));
     return false;
@@ -813,7 +1284,7 @@ bool ZgwConn::GetSourceObject(std::string* content) {
     LOG(ERROR) << "Ref objects name list failed: " << s.ToString();
     return false;
   }
-  if (tmp_obnames == NULL || !tmp_obnames->IsExist(src_object_name)) {
+  if (tmp_obnames == NULL || !tmp_obnames->IsExist(store_, src_object_name)) {
     resp_->SetStatusCode(404);
     resp_->SetBody(ErrorXml(NoSuchKey, src_object_name));
     g_zgw_server->UnrefObjectList(store_, src_bucket_name);
@@ -821,34 +1292,59 @@ bool ZgwConn::GetSourceObject(std::string* content) {
   }
   g_zgw_server->UnrefObjectList(store_, src_bucket_name);
 
-  // Get source object
-  libzgw::ZgwObject src_object(src_bucket_name, src_object_name);
-  std::vector<std::pair<int, uint32_t>> segments;
+  // Only the meta is read here, data is streamed by CopySourceObject
+  *src = libzgw::ZgwObject(src_bucket_name, src_object_name);
+  s = store_->GetObject(src, false);
+  if (!s.ok()) {
+    resp_->SetStatusCode(500);
+    LOG(ERROR) << "Get copy source object failed: " << s.ToString();
+    return false;
+  }
+
+  uint64_t src_size = src->info().size;
+  *offset = 0;
+  *size = src_size;
+  std::vector<std::pair<int64_t, uint64_t>> segments;
   if (!req_->headers["x-amz-copy-source-range"].empty() &&
       !ParseRange(req_->headers["x-amz-copy-source-range"], &segments)) {
     return false;
   }
-  bool need_partial = !segments.empty();
-  if (need_partial) {
-    DLOG(INFO) << "Get partial object: " << source << " " << segments[0].first << "-" << segments[0].second;
-    Timer t("GetObject: GetPartialObject from zp");
-    s = store_->GetPartialObject(&src_object, segments);
-    if (s.IsEndFile()) {
+  if (!segments.empty()) {
+    if (!libzgw::ResolveByteRange(segments[0].first, segments[0].second,
+                                  src_size, offset, size)) {
       resp_->SetStatusCode(416);
       resp_->SetBody(ErrorXml(InvalidRange, bucket_name_));
       return false;
     }
-  } else {
-    Timer t("GetObject: GetObject from zp");
-    s = store_->GetObject(&src_object, true);
+    DLOG(INFO) << "Copy partial object: " << source << " " << *offset << "+" << *size;
   }
-  if (!s.ok()) {
+  return true;
+}
+
+bool ZgwConn::CopySourceObject(const libzgw::ZgwObject& src, uint64_t offset,
+                               uint64_t size, libzgw::ZgwObjectWriter* writer) {
+  Status s;
+  if (offset == 0 && size == src.info().size && src.content_addressed()) {
+    // Strips stored by content are shared instead of copied
+    s = writer->Link(src);
+    if (s.ok()) {
+      return true;
+    }
+    DLOG(INFO) << "Link copy source failed, copy data: " << s.ToString();
+  }
+  libzgw::ZgwObjectReader reader(store_, src, offset, size);
+  std::string strip;
+  while ((s = reader.Next(&strip)).ok()) {
+    s = writer->Append(strip);
+    if (!s.ok()) {
+      break;
+    }
+  }
+  if (!s.IsEndFile()) {
     resp_->SetStatusCode(500);
-    LOG(ERROR) << "Put copy object data failed: " << s.ToString();
+    LOG(ERROR) << "Copy object data failed: " << s.ToString();
     return false;
   }
-
-  content->assign(src_object.content());
   return true;
 }
 
@@ -858,40 +1354,48 @@ void ZgwConn::PutObjectHandle() {
   Status s;
   timeval now;
   gettimeofday(&now, NULL);
-  std::string etag;
-  std::string object_content;
   // Handle copy operation
   bool is_copy_op = !req_->headers["x-amz-copy-source"].empty();
+  libzgw::ZgwObject src_object("", "");
+  uint64_t copy_offset = 0, copy_size = 0;
   if (is_copy_op) {
-    Timer t("PutObject: GetSourceObject");
-    bool res = GetSourceObject(&object_content);
-    DLOG(INFO) << "PutObject: " << "SourceObject Size: " << object_content.size();
+    bool res = GetSourceObject(&src_object, &copy_offset, &copy_size);
+    DLOG(INFO) << "PutObject: " << "SourceObject Size: " << copy_size;
     if (!res) {
       return;
     }
-  } else {
-    object_content = req_->content;
-  }
-  {
-  Timer t("PutObject: Calc md5");
-  etag.assign("\"" + md5(object_content) + "\"");
   }
-  libzgw::ZgwObjectInfo ob_info(now, etag, object_content.size(), libzgw::kStandard,
+  libzgw::ZgwObjectInfo ob_info(now, "", 0, libzgw::kStandard,
                                 zgw_user_->user_info());
-  libzgw::ZgwObject object(bucket_name_, object_name_, object_content, ob_info);
-  {
-  Timer t("PutObject: AddObject");
-  s = store_->AddObject(object);
+  libzgw::ZgwObjectWriter writer(store_, bucket_name_, object_name_, ob_info,
+                                 is_copy_op ? copy_size : RequestBodySize());
+  // Held under the object lock, so the name list is current
+  if (!objects_name_->IsExist(store_, object_name_)) {
+    writer.SetNewObject();
   }
+  if (is_copy_op) {
+    if (!CopySourceObject(src_object, copy_offset, copy_size, &writer)) {
+      return;
+    }
+  } else if (!AppendRequestBody(&writer)) {
+    return;
+  }
+  s = writer.Finish();
   if (!s.ok()) {
     resp_->SetStatusCode(500);
     LOG(ERROR) << "Put object data failed: " << s.ToString();
     return;
   }
+  const std::string& etag = writer.object().info().etag;
   DLOG(INFO) << "PutObject: " << req_->path << " confirm add to zp success";
 
   // Put object to list meta
-  objects_name_->Insert(object_name_);
+  s = objects_name_->Insert(store_, object_name_);
+  if (!s.ok()) {
+    resp_->SetStatusCode(500);
+    LOG(ERROR) << "Put object to namelist failed: " << s.ToString();
+    return;
+  }
 
   DLOG(INFO) << "PutObject: " << req_->path << " confirm add to namelist success";
 
@@ -905,7 +1409,7 @@ void ZgwConn::PutObjectHandle() {
 void ZgwConn::GetBucketLocationHandle() {
   DLOG(INFO) << "GetBucketLocation: " << bucket_name_;
   // Check whether bucket existed in namelist meta
-  if (!buckets_name_->IsExist(bucket_name_)) {
+  if (!buckets_name_->IsExist(store_, bucket_name_)) {
     resp_->SetStatusCode(404);
     resp_->SetBody(ErrorXml(NoSuchBucket, bucket_name_));
     return;
@@ -921,7 +1425,7 @@ void ZgwConn::ListObjectHandle() {
   DLOG(INFO) << "ListObjects: " << bucket_name_;
 
   // Check whether bucket existed in namelist meta
-  if (!buckets_name_->IsExist(bucket_name_)) {
+  if (!buckets_name_->IsExist(store_, bucket_name_)) {
     resp_->SetStatusCode(404);
     resp_->SetBody(ErrorXml(NoSuchBucket, bucket_name_));
     return;
@@ -958,86 +1462,83 @@ void ZgwConn::ListObjectHandle() {
 
   bool is_trucated = false;
 
-  // Get objects meta from zp
+  // Seek to the first name that may be listed
+  std::string seek = prefix;
+  std::string from;
+  bool more = true;
+  if (is_listv2.empty()) {
+    // v1 marker excludes itself and every name it prefixes
+    if (!marker.empty()) {
+      more = PrefixSuccessor(marker, &from);
+    }
+  } else {
+    from = req_->query_params["continuation-token"];
+    if (from.empty()) {
+      from = start_after;
+    }
+  }
+  seek = std::max(seek, from);
+
+  // Names are visited in order, whole common prefix ranges and the
+  // internal object range are skipped, stop after max keys
   Status s;
   std::set<std::string> commonprefixes;
   std::vector<std::string> candidate_names;
   std::vector<libzgw::ZgwObject> objects;
-  {
-    std::lock_guard<std::mutex> lock(objects_name_->list_lock);
-    for (auto &name : objects_name_->name_list) {
-      if (name.compare(0, 2, libzgw::kInternalObjectNamePrefix) == 0) {
-        // Skip Internal Object
-        continue;
-      }
-      if (!prefix.empty() &&
-          name.substr(0, std::min(name.size(), prefix.size())) != prefix) {
-        // Skip prefix
-        continue;
-      }
-      if (!start_after.empty() && !is_listv2.empty() &&
-          name.substr(0, std::min(name.size(), start_after.size())) < start_after) {
-        // Skip start after v2
-        continue;
-      }
-      if (!marker.empty() && is_listv2.empty() &&
-          name.substr(0, std::min(name.size(), marker.size())) <= marker) {
-        // Skip marker v1
-        continue;
+  std::string name, entry, last_entry, next_token;
+  int key_count = 0;
+  while (more) {
+    s = objects_name_->LowerBound(store_, seek, &name);
+    if (!s.ok()) {
+      break;
+    }
+    if (name.compare(0, prefix.size(), prefix) != 0) {
+      // Past the prefix range
+      break;
+    }
+    if (name.compare(0, 2, libzgw::kInternalObjectNamePrefix) == 0) {
+      // Skip Internal Object
+      more = PrefixSuccessor(libzgw::kInternalObjectNamePrefix, &seek);
+      continue;
+    }
+    bool is_commonprefix = false;
+    entry = name;
+    if (!delimiter.empty()) {
+      size_t pos = name.find(delimiter[0], prefix.size());
+      if (pos != std::string::npos) {
+        entry = name.substr(0, pos + 1);
+        is_commonprefix = true;
       }
-      if (!delimiter.empty()) {
-        size_t pos = name.find_first_of(delimiter, prefix.size());
-        if (pos != std::string::npos) {
-          commonprefixes.insert(name.substr(0, std::min(name.size(), pos + 1)));
-          continue;
-        }
+    }
+    if (key_count >= max_keys) {
+      // Is not trucated if max keys equal zero
+      if (max_keys > 0) {
+        is_trucated = true;
+        next_token = entry;
       }
-
-      candidate_names.push_back(name);
+      break;
     }
-  }
 
-  // Success Http response
-  int diff = commonprefixes.size() + candidate_names.size()
-    - static_cast<size_t>(max_keys);
-  is_trucated = diff > 0;
-  std::string next_token;
-  if (is_trucated) {
-    size_t extra_num = diff;
-    if (commonprefixes.size() >= extra_num) {
-      for (auto it = commonprefixes.rbegin();
-           it != commonprefixes.rend() && extra_num--;) {
-        next_token = *(it++);
-        commonprefixes.erase(next_token);
-      }
+    ++key_count;
+    last_entry = entry;
+    if (is_commonprefix) {
+      commonprefixes.insert(entry);
+      more = PrefixSuccessor(entry, &seek);
     } else {
-      // extra_num > commonprefixes.size()
-      extra_num -= commonprefixes.size();
-      commonprefixes.clear();
-      if (candidate_names.size() <= extra_num) {
-        candidate_names.clear();
-      } else {
-        while (extra_num--) {
-          next_token = candidate_names.back();
-          candidate_names.pop_back();
-        }
-      }
+      candidate_names.push_back(name);
+      seek = name + '\0';
     }
   }
-  // Is not trucated if max keys equal zero
-  is_trucated = is_trucated && max_keys > 0;
+  if (!s.ok() && !s.IsNotFound()) {
+    resp_->SetStatusCode(500);
+    LOG(ERROR) << "Scan objects name list failed: " << s.ToString();
+    return;
+  }
+
   std::string next_marker;
   if (is_trucated &&
       !delimiter.empty()) {
-    if (!commonprefixes.empty()) {
-      next_marker = *commonprefixes.rbegin();
-    } else if (!candidate_names.empty()) {
-      next_marker = candidate_names.back();
-    }
-  }
-
-  if (!is_trucated) {
-    next_token.clear();
+    next_marker = last_entry;
   }
 
   std::map<std::string, std::string> args {
@@ -1056,15 +1557,11 @@ void ZgwConn::ListObjectHandle() {
   } else {
     // ListObject v2
     args.insert(std::make_pair("StartAfter", start_after));
-    int key_count = commonprefixes.size() + candidate_names.size();
     args.insert(std::make_pair("KeyCount", std::to_string(key_count)));
     args.insert(std::make_pair("NextContinuationToken", next_token));
   }
 
-  {
-  Timer t("ListObjects: ListObjects");
   s = store_->ListObjects(bucket_name_, candidate_names, &objects);
-  }
   if (!s.ok()) {
     resp_->SetStatusCode(500);
     LOG(ERROR) << "ListObjects failed: " << s.ToString();
@@ -1072,6 +1569,7 @@ void ZgwConn::ListObjectHandle() {
   }
   DLOG(INFO) << "ListObjects: " << req_->path << " confirm get objects' meta from zp success";
 
+  PhaseTimer t(metrics_, &op_, kPhaseXml);
   resp_->SetBody(ListObjectsXml(objects, args, commonprefixes));
   resp_->SetStatusCode(200);
 }
@@ -1079,7 +1577,7 @@ void ZgwConn::ListObjectHandle() {
 void ZgwConn::DelBucketHandle() {
   DLOG(INFO) << "DeleteBucket: " << bucket_name_;
   // Check whether bucket existed in namelist meta
-  if (!buckets_name_->IsExist(bucket_name_)) {
+  if (!buckets_name_->IsExist(store_, bucket_name_)) {
     resp_->SetStatusCode(404);
     resp_->SetBody(ErrorXml(NoSuchBucket, bucket_name_));
     return;
@@ -1102,35 +1600,45 @@ void ZgwConn::DelBucketHandle() {
   }
 
   // AbortAllMultiPartUpload
-  if (objects_name_ != NULL && !objects_name_->IsEmpty()) {
-    bool has_normal_object = false;
-    std::lock_guard<std::mutex> lock(objects_name_->list_lock);
-    for (auto &name : objects_name_->name_list) {
+  if (objects_name_ != NULL && !objects_name_->IsEmpty(store_)) {
+    std::vector<std::string> internal_names;
+    std::string name;
+    for (s = objects_name_->LowerBound(store_, "", &name); s.ok();
+         s = objects_name_->LowerBound(store_, name + '\0', &name)) {
       if (name.find(libzgw::kInternalObjectNamePrefix) != 0) {
-        has_normal_object = true;
         break;
       }
-    }
-    if (!has_normal_object) {
-      for (auto &name : objects_name_->name_list) {
-        s = store_->DelObject(bucket_name_, name);
-        if (!s.ok()) {
-          resp_->SetStatusCode(500);
-          LOG(ERROR) << "Delete bucket failed: " << s.ToString();
-        }
+      if (name.find(libzgw::kInternalUploadIndexPrefix) == 0) {
+        // Upload index, has no meta
+        continue;
       }
-      objects_name_->name_list.clear();
-    } else {
+      internal_names.push_back(name);
+    }
+    if (s.ok()) {
       resp_->SetStatusCode(409);
       resp_->SetBody(ErrorXml(BucketNotEmpty, bucket_name_));
       LOG(ERROR) << "DeleteBucket: BucketNotEmpty";
       return;
+    } else if (!s.IsNotFound()) {
+      resp_->SetStatusCode(500);
+      LOG(ERROR) << "Delete bucket failed: " << s.ToString();
+      return;
     }
+    for (auto &name : internal_names) {
+      s = store_->DelObject(bucket_name_, name);
+      if (!s.ok()) {
+        resp_->SetStatusCode(500);
+        LOG(ERROR) << "Delete bucket failed: " << s.ToString();
+      }
+    }
+    objects_name_->Clear();
   }
 
   s = store_->DelBucket(bucket_name_);
   if (s.ok()) {
-    buckets_name_->Delete(bucket_name_);
+    s = buckets_name_->Delete(store_, bucket_name_);
+  }
+  if (s.ok()) {
     resp_->SetStatusCode(204);
   } else if (s.IsIOError()) {
     resp_->SetStatusCode(500);
@@ -1144,7 +1652,7 @@ void ZgwConn::PutBucketHandle() {
   DLOG(INFO) << "CreateBucket: " << bucket_name_;
 
   // Check whether bucket existed in namelist meta
-  if (buckets_name_->IsExist(bucket_name_)) {
+  if (buckets_name_->IsExist(store_, bucket_name_)) {
     resp_->SetStatusCode(409);
     resp_->SetBody(ErrorXml(BucketAlreadyOwnedByYou, ""));
     return;
@@ -1167,7 +1675,7 @@ void ZgwConn::PutBucketHandle() {
       LOG(ERROR) << "Create bucket failed: " << s.ToString();
       return;
     }
-    if (tmp_bk_list->IsExist(bucket_name_)) {
+    if (tmp_bk_list->IsExist(store_, bucket_name_)) {
       already_exist = true;
     }
     s = g_zgw_server->UnrefBucketList(store_, access_key);
@@ -1195,7 +1703,12 @@ void ZgwConn::PutBucketHandle() {
   DLOG(INFO) << "PutBucket: " << req_->path << " confirm add bucket to zp success";
 
   // Create list meta info
-  buckets_name_->Insert(bucket_name_);
+  s = buckets_name_->Insert(store_, bucket_name_);
+  if (!s.ok()) {
+    resp_->SetStatusCode(500);
+    LOG(ERROR) << "Create bucket failed: " << s.ToString();
+    return;
+  }
 
   DLOG(INFO) << "PutBucket: " << req_->path << " confirm add bucket to namelist success";
 
@@ -1210,11 +1723,10 @@ void ZgwConn::ListBucketHandle() {
   Status s;
   std::vector<libzgw::ZgwBucket> buckets;
   std::set<std::string> name_list;
-  {
-    std::lock_guard<std::mutex> lock(buckets_name_->list_lock);
-    name_list = buckets_name_->name_list;
+  s = buckets_name_->ListAll(store_, &name_list);
+  if (s.ok()) {
+    s = store_->ListBucket(name_list, &buckets);
   }
-  s = store_->ListBucket(name_list, &buckets);
   if (!s.ok()) {
     resp_->SetStatusCode(500);
     LOG(ERROR) << "ListBuckets failed: " << s.ToString();
@@ -1225,5 +1737,6 @@ void ZgwConn::ListBucketHandle() {
 
   const libzgw::ZgwUserInfo &info = zgw_user_->user_info();
   resp_->SetStatusCode(200);
+  PhaseTimer t(metrics_, &op_, kPhaseXml);
   resp_->SetBody(ListBucketXml(info, buckets));
 }
@@ -3,6 +3,9 @@
 
 #include "pink/include/http_conn.h"
 #include "src/libzgw/zgw_store.h"
+#include "src/libzgw/zgw_stream.h"
+#include "src/zgw_auth.h"
+#include "src/zgw_metrics.h"
 
 class ZgwWorkerThread;
 
@@ -55,6 +58,18 @@ class ZgwConn : public pink::HttpConn {
   pink::HttpResponse* resp_;
   std::string bucket_name_;
   std::string object_name_;
+  // aws-chunked request body
+  bool streaming_payload_;
+  ZgwChunkDecoder chunk_decoder_;
+
+  ZgwMetrics* metrics_;
+  // Operation of the request being dealt with
+  ZgwOp op_;
+  std::string request_id_;
+  // zeppelin calls of the request, kept for the slow log only
+  libzgw::ZgwTrace trace_;
+
+  class RequestScope;
 
   // Get from zp
   libzgw::NameList* buckets_name_;
@@ -62,11 +77,39 @@ class ZgwConn : public pink::HttpConn {
   libzgw::ZgwUser* zgw_user_;
 
   void PreProcessUrl();
+  ZgwOp ParseOp();
+  // Call the handler of op_
+  void Dispatch();
   bool IsValidBucket();
   bool IsValidObject();
+  // Ranges of a Range header as for libzgw::ResolveByteRange, none if
+  // the header is to be ignored. Response is set on failure
   bool ParseRange(const std::string& range,
-                  std::vector<std::pair<int, uint32_t>>* segments);
-  bool GetSourceObject(std::string* content);
+                  std::vector<std::pair<int64_t, uint64_t>>* segments);
+  // Evaluate the If-Match, If-Unmodified-Since, If-None-Match and
+  // If-Modified-Since headers against info, false with the response set
+  // to 412 or 304 if the object is not to be sent
+  bool CheckConditions(const libzgw::ZgwObjectInfo& info);
+  // Append the offset : length ranges of object to body in order, as
+  // the parts of a multipart/byteranges body if boundary is not empty
+  Status ReadRanges(const libzgw::ZgwObject& object,
+                    const std::vector<std::pair<uint64_t, uint64_t>>& ranges,
+                    const std::string& boundary, std::string* body);
+  // Find the x-amz-copy-source object and the bytes of it to copy,
+  // response is set on failure
+  bool GetSourceObject(libzgw::ZgwObject* src, uint64_t* offset,
+                       uint64_t* size);
+  // Stream the range of src into writer strip by strip, src is locked by
+  // DealMessage so its strips are not reclaimed meanwhile
+  bool CopySourceObject(const libzgw::ZgwObject& src, uint64_t offset,
+                        uint64_t size, libzgw::ZgwObjectWriter* writer);
+  // Add the in progress uploads of the bucket to its upload index, once
+  // for buckets whose uploads predate it
+  Status IndexUploads();
+  // Object size the request body decodes to
+  uint64_t RequestBodySize();
+  // Append the request body to writer, response is set on failure
+  bool AppendRequestBody(libzgw::ZgwObjectWriter* writer);
 };
 
 class ZgwConnFactory : public pink::ConnFactory {
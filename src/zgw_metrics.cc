@@ -0,0 +1,228 @@
+#include "src/zgw_metrics.h"
+
+#include <cstdio>
+
+static const char* kOpNames[kOpCount] = {
+  "ListBuckets",
+  "PutBucket",
+  "DeleteBucket",
+  "HeadBucket",
+  "GetBucketLocation",
+  "ListObjects",
+  "ListMultipartUploads",
+  "DeleteObjects",
+  "GetObject",
+  "HeadObject",
+  "PutObject",
+  "DeleteObject",
+  "CreateMultipartUpload",
+  "UploadPart",
+  "CompleteMultipartUpload",
+  "AbortMultipartUpload",
+  "ListParts",
+  "Unknown"
+};
+
+static const char* kPhaseNames[kPhaseCount] = {
+  "auth",
+  "namelist_ref",
+  "object_lock",
+  "zp_io",
+  "xml",
+  "namelist_unref"
+};
+
+const char* ZgwOpName(ZgwOp op) {
+  return kOpNames[op];
+}
+
+const char* ZgwPhaseName(ZgwPhase phase) {
+  return kPhaseNames[phase];
+}
+
+int LatencyHistogram::BucketIndex(uint64_t micros) {
+  if (micros < static_cast<uint64_t>(kSubBuckets)) {
+    return static_cast<int>(micros);
+  }
+  int exp = 63 - __builtin_clzll(micros);
+  if (exp > kMaxExp) {
+    return kBucketNum - 1;
+  }
+  int sub = static_cast<int>(micros >> (exp - kSubBits)) & (kSubBuckets - 1);
+  return (exp - kSubBits + 1) * kSubBuckets + sub;
+}
+
+uint64_t LatencyHistogram::BucketLower(int index) {
+  if (index < kSubBuckets) {
+    return index;
+  }
+  int exp = index / kSubBuckets + kSubBits - 1;
+  uint64_t sub = index % kSubBuckets;
+  return (kSubBuckets + sub) << (exp - kSubBits);
+}
+
+LatencyHistogram::LatencyHistogram()
+    : count_(0),
+      sum_(0) {
+  for (auto& b : buckets_) {
+    b.store(0, std::memory_order_relaxed);
+  }
+}
+
+HistogramSnapshot::HistogramSnapshot()
+    : count(0),
+      sum(0) {
+  for (auto& b : buckets) {
+    b = 0;
+  }
+}
+
+void HistogramSnapshot::Merge(const LatencyHistogram& hist) {
+  for (int i = 0; i < LatencyHistogram::kBucketNum; i++) {
+    buckets[i] += hist.bucket(i);
+  }
+  count += hist.count();
+  sum += hist.sum();
+}
+
+uint64_t HistogramSnapshot::Percentile(double q) const {
+  // Buckets are read one by one while being written, count them again
+  uint64_t total = 0;
+  for (int i = 0; i < LatencyHistogram::kBucketNum; i++) {
+    total += buckets[i];
+  }
+  if (total == 0) {
+    return 0;
+  }
+  uint64_t rank = static_cast<uint64_t>(q * total);
+  uint64_t seen = 0;
+  for (int i = 0; i < LatencyHistogram::kBucketNum - 1; i++) {
+    seen += buckets[i];
+    if (seen > rank) {
+      return LatencyHistogram::BucketLower(i + 1);
+    }
+  }
+  return LatencyHistogram::BucketLower(LatencyHistogram::kBucketNum - 1);
+}
+
+ThreadMetrics::ThreadMetrics() {
+  for (auto& op : phase_micros) {
+    for (auto& v : op) {
+      v.store(0, std::memory_order_relaxed);
+    }
+  }
+}
+
+ThreadMetrics* ZgwMetrics::Local() {
+  static thread_local ZgwMetrics* owner = nullptr;
+  static thread_local ThreadMetrics* local = nullptr;
+  if (owner != this) {
+    std::lock_guard<std::mutex> lock(slots_mutex_);
+    slots_.push_back(std::unique_ptr<ThreadMetrics>(new ThreadMetrics()));
+    local = slots_.back().get();
+    owner = this;
+  }
+  return local;
+}
+
+uint64_t ZgwMetrics::TotalRequests() {
+  uint64_t total = 0;
+  std::lock_guard<std::mutex> lock(slots_mutex_);
+  for (auto& slot : slots_) {
+    for (auto& hist : slot->requests) {
+      total += hist.count();
+    }
+  }
+  return total;
+}
+
+void ZgwMetrics::GetRequestHistogram(ZgwOp op, HistogramSnapshot* snapshot) {
+  std::lock_guard<std::mutex> lock(slots_mutex_);
+  for (auto& slot : slots_) {
+    snapshot->Merge(slot->requests[op]);
+  }
+}
+
+static std::string Seconds(uint64_t micros) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.6f", micros / 1e6);
+  return buf;
+}
+
+// Exported buckets end at powers of two, the finer ones are kept for
+// Percentile
+static void AppendHistogram(const std::string& name, const std::string& labels,
+                            const HistogramSnapshot& hist, std::string* out) {
+  const int kOctave = LatencyHistogram::kSubBuckets;
+  uint64_t cumulative = 0;
+  for (int i = 0; i < LatencyHistogram::kBucketNum - 1; i++) {
+    cumulative += hist.buckets[i];
+    if ((i + 1) % kOctave == 0 && i + 1 >= 2 * kOctave) {
+      out->append(name + "_bucket{" + labels + ",le=\""
+                  + Seconds(LatencyHistogram::BucketLower(i + 1)) + "\"} "
+                  + std::to_string(cumulative) + "\n");
+    }
+  }
+  cumulative += hist.buckets[LatencyHistogram::kBucketNum - 1];
+  out->append(name + "_bucket{" + labels + ",le=\"+Inf\"} "
+              + std::to_string(cumulative) + "\n");
+  out->append(name + "_sum{" + labels + "} " + Seconds(hist.sum) + "\n");
+  out->append(name + "_count{" + labels + "} " + std::to_string(cumulative) + "\n");
+}
+
+void ZgwMetrics::AppendPrometheus(std::string* out) {
+  std::vector<HistogramSnapshot> requests(kOpCount);
+  std::vector<HistogramSnapshot> phases(kPhaseCount);
+  uint64_t phase_micros[kOpCount][kPhaseCount] = {{0}};
+  {
+    std::lock_guard<std::mutex> lock(slots_mutex_);
+    for (auto& slot : slots_) {
+      for (int op = 0; op < kOpCount; op++) {
+        requests[op].Merge(slot->requests[op]);
+        for (int p = 0; p < kPhaseCount; p++) {
+          phase_micros[op][p] +=
+            slot->phase_micros[op][p].load(std::memory_order_relaxed);
+        }
+      }
+      for (int p = 0; p < kPhaseCount; p++) {
+        phases[p].Merge(slot->phases[p]);
+      }
+    }
+  }
+
+  // Operations never seen are left out
+  out->append("# HELP zgw_request_duration_seconds S3 request latency.\n");
+  out->append("# TYPE zgw_request_duration_seconds histogram\n");
+  for (int op = 0; op < kOpCount; op++) {
+    if (requests[op].count == 0) {
+      continue;
+    }
+    AppendHistogram("zgw_request_duration_seconds",
+                    std::string("op=\"") + kOpNames[op] + "\"",
+                    requests[op], out);
+  }
+
+  out->append("# HELP zgw_phase_duration_seconds Latency of one request phase.\n");
+  out->append("# TYPE zgw_phase_duration_seconds histogram\n");
+  for (int p = 0; p < kPhaseCount; p++) {
+    if (phases[p].count == 0) {
+      continue;
+    }
+    AppendHistogram("zgw_phase_duration_seconds",
+                    std::string("phase=\"") + kPhaseNames[p] + "\"",
+                    phases[p], out);
+  }
+
+  out->append("# HELP zgw_phase_seconds_total Time spent per operation and phase.\n");
+  out->append("# TYPE zgw_phase_seconds_total counter\n");
+  for (int op = 0; op < kOpCount; op++) {
+    if (requests[op].count == 0) {
+      continue;
+    }
+    for (int p = 0; p < kPhaseCount; p++) {
+      out->append(std::string("zgw_phase_seconds_total{op=\"") + kOpNames[op]
+                  + "\",phase=\"" + kPhaseNames[p] + "\"} "
+                  + Seconds(phase_micros[op][p]) + "\n");
+    }
+  }
+}
@@ -0,0 +1,176 @@
+#ifndef ZGW_METRICS_H
+#define ZGW_METRICS_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+// S3 operations a request is accounted to
+enum ZgwOp {
+  kOpListBuckets = 0,
+  kOpPutBucket,
+  kOpDelBucket,
+  kOpHeadBucket,
+  kOpGetBucketLocation,
+  kOpListObjects,
+  kOpListMultipartUploads,
+  kOpDelMultiObjects,
+  kOpGetObject,
+  kOpHeadObject,
+  kOpPutObject,
+  kOpDelObject,
+  kOpInitMultipartUpload,
+  kOpUploadPart,
+  kOpCompleteMultipartUpload,
+  kOpAbortMultipartUpload,
+  kOpListParts,
+  kOpUnknown,
+  kOpCount
+};
+
+// Parts of a request timed on their own, zp I/O is summed over the whole
+// request and so overlaps the others
+enum ZgwPhase {
+  kPhaseAuth = 0,
+  kPhaseNameListRef,
+  kPhaseObjectLock,
+  kPhaseZpIO,
+  kPhaseXml,
+  kPhaseNameListUnref,
+  kPhaseCount
+};
+
+extern const char* ZgwOpName(ZgwOp op);
+extern const char* ZgwPhaseName(ZgwPhase phase);
+
+// Latency histogram in microseconds, log linear with 4 buckets per
+// power of two, so a bucket is at most 25% wide
+class LatencyHistogram {
+ public:
+  static const int kSubBits = 2;
+  static const int kSubBuckets = 1 << kSubBits;
+  // Up to 2^36us, larger values fall in the last bucket
+  static const int kMaxExp = 35;
+  static const int kBucketNum = (kMaxExp - kSubBits + 2) * kSubBuckets;
+
+  static int BucketIndex(uint64_t micros);
+  // Smallest value falling in bucket index
+  static uint64_t BucketLower(int index);
+
+  LatencyHistogram();
+
+  // Only the owning thread adds
+  void Add(uint64_t micros) {
+    Bump(&buckets_[BucketIndex(micros)], 1);
+    Bump(&count_, 1);
+    Bump(&sum_, micros);
+  }
+
+  uint64_t count() const {
+    return count_.load(std::memory_order_relaxed);
+  }
+  uint64_t sum() const {
+    return sum_.load(std::memory_order_relaxed);
+  }
+  uint64_t bucket(int index) const {
+    return buckets_[index].load(std::memory_order_relaxed);
+  }
+
+ private:
+  std::atomic<uint64_t> buckets_[kBucketNum];
+  std::atomic<uint64_t> count_;
+  std::atomic<uint64_t> sum_;
+
+  // Single writer, no locked instruction needed
+  static void Bump(std::atomic<uint64_t>* v, uint64_t n) {
+    v->store(v->load(std::memory_order_relaxed) + n,
+             std::memory_order_relaxed);
+  }
+};
+
+// Histograms of all threads added up
+struct HistogramSnapshot {
+  uint64_t buckets[LatencyHistogram::kBucketNum];
+  uint64_t count;
+  uint64_t sum;
+
+  HistogramSnapshot();
+  void Merge(const LatencyHistogram& hist);
+  // Upper bound of the bucket holding quantile q, 0 if empty
+  uint64_t Percentile(double q) const;
+};
+
+// Request metrics of one thread, written by it alone
+struct ThreadMetrics {
+  LatencyHistogram requests[kOpCount];
+  LatencyHistogram phases[kPhaseCount];
+  // Microseconds per operation and phase
+  std::atomic<uint64_t> phase_micros[kOpCount][kPhaseCount];
+
+  ThreadMetrics();
+};
+
+// Every thread records into its own ThreadMetrics, readers add them up,
+// so recording takes no lock and shares no cache line
+class ZgwMetrics {
+ public:
+  ZgwMetrics() {}
+
+  void AddRequest(ZgwOp op, uint64_t micros) {
+    Local()->requests[op].Add(micros);
+  }
+
+  void AddPhase(ZgwOp op, ZgwPhase phase, uint64_t micros) {
+    ThreadMetrics* local = Local();
+    local->phases[phase].Add(micros);
+    std::atomic<uint64_t>* v = &local->phase_micros[op][phase];
+    v->store(v->load(std::memory_order_relaxed) + micros,
+             std::memory_order_relaxed);
+  }
+
+  uint64_t TotalRequests();
+  void GetRequestHistogram(ZgwOp op, HistogramSnapshot* snapshot);
+
+  // Prometheus text exposition format
+  void AppendPrometheus(std::string* out);
+
+ private:
+  std::mutex slots_mutex_;
+  std::vector<std::unique_ptr<ThreadMetrics>> slots_;
+
+  // Slot of the calling thread, registered on first use
+  ThreadMetrics* Local();
+
+  // No copying allowed
+  ZgwMetrics(const ZgwMetrics&);
+  void operator=(const ZgwMetrics&);
+};
+
+// Time one phase of a request, recorded when it goes out of scope
+class PhaseTimer {
+ public:
+  PhaseTimer(ZgwMetrics* metrics, const ZgwOp* op, ZgwPhase phase)
+      : metrics_(metrics),
+        op_(op),
+        phase_(phase),
+        start_(std::chrono::steady_clock::now()) {
+  }
+
+  ~PhaseTimer() {
+    auto elapsed = std::chrono::steady_clock::now() - start_;
+    metrics_->AddPhase(*op_, phase_,
+        std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+  }
+
+ private:
+  ZgwMetrics* metrics_;
+  // Read at the end, the operation may be known only by then
+  const ZgwOp* op_;
+  ZgwPhase phase_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+#endif
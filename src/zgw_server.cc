@@ -1,5 +1,8 @@
 #include "src/zgw_server.h"
 
+#include <unistd.h>
+#include <cinttypes>
+
 #include <glog/logging.h>
 #include "slash/include/slash_mutex.h"
 #include "slash/include/env.h"
@@ -8,7 +11,7 @@ extern ZgwConfig* g_zgw_conf;
 
 int MyThreadEnvHandle::SetEnv(void** env) const {
   libzgw::ZgwStore* store;
-  Status s = libzgw::ZgwStore::Open(g_zgw_conf->zp_meta_ip_ports, &store);
+  Status s = libzgw::ZgwStore::Open(options_, &store);
   if (!s.ok()) {
     LOG(FATAL) << "Can not open ZgwStore: " << s.ToString();
     return -1;
@@ -23,17 +26,59 @@ ZgwServer::ZgwServer()
       worker_num_(g_zgw_conf->worker_num),
       port_(g_zgw_conf->server_port),
       admin_port_(g_zgw_conf->admin_port),
+      user_table_(new libzgw::ZgwUserTable()),
+      mem_store_(nullptr),
+      cron_store_(nullptr),
+      strip_gc_(new libzgw::StripGc()),
+      gc_store_(nullptr),
+      strip_cache_(nullptr),
+      meta_cache_(nullptr),
+      flush_store_(nullptr),
+      flush_kicked_(false),
+      flusher_exit_(false),
+      flush_interval_us_(g_zgw_conf->name_list_flush_interval_ms * 1000ULL),
       last_query_num_(0),
-      cur_query_num_(0),
-      last_time_us_(0) {
-  pthread_rwlock_init(&qps_lock_, NULL);
+      last_time_us_(0),
+      qps_(0),
+      request_seq_(0) {
   last_time_us_ = slash::NowMicros();
+  char buf[64];
+  snprintf(buf, sizeof(buf), "-%010lx-%x", static_cast<long>(time(NULL)),
+           static_cast<unsigned>(getpid()));
+  request_id_suffix_ = buf;
   if (worker_num_ > kMaxWorkerThread) {
     LOG(WARNING) << "Exceed max worker thread num: " << kMaxWorkerThread;
     worker_num_ = kMaxWorkerThread;
   }
 
-  MyThreadEnvHandle* thandle = new MyThreadEnvHandle();
+  if (g_zgw_conf->backend == "memory") {
+    libzgw::MemStoreOptions mem_options;
+    mem_options.latency_us = g_zgw_conf->memory_backend_latency_us;
+    mem_options.latency_jitter_us = g_zgw_conf->memory_backend_latency_jitter_us;
+    mem_store_ = new libzgw::MemStore(mem_options);
+    LOG(WARNING) << "Using the memory backend, nothing is persisted";
+  }
+  if (g_zgw_conf->strip_cache_mb > 0) {
+    strip_cache_ = new libzgw::StripCache(
+        static_cast<uint64_t>(g_zgw_conf->strip_cache_mb) << 20);
+  }
+  if (g_zgw_conf->object_meta_cache_mb > 0) {
+    meta_cache_ = new libzgw::MetaCache(
+        static_cast<uint64_t>(g_zgw_conf->object_meta_cache_mb) << 20,
+        g_zgw_conf->object_meta_cache_ttl_ms * 1000ULL);
+  }
+  store_options_.zp_meta_ip_ports = g_zgw_conf->zp_meta_ip_ports;
+  store_options_.strip_io_window = g_zgw_conf->strip_io_window;
+  store_options_.strip_len_policy = g_zgw_conf->strip_len_policy;
+  store_options_.inline_max_size = g_zgw_conf->inline_object_max_bytes;
+  store_options_.content_addressed = g_zgw_conf->content_addressed_strips;
+  store_options_.user_table = user_table_;
+  store_options_.mem_store = mem_store_;
+  store_options_.strip_gc = strip_gc_;
+  store_options_.strip_cache = strip_cache_;
+  store_options_.meta_cache = meta_cache_;
+
+  MyThreadEnvHandle* thandle = new MyThreadEnvHandle(store_options_);
 
   conn_factory_ = new ZgwConnFactory();
   std::set<std::string> ips;
@@ -48,8 +93,15 @@ ZgwServer::ZgwServer()
                                           0, nullptr, thandle);
   zgw_admin_thread_->set_thread_name("AdminThread");
 
-  buckets_list_ = new libzgw::ListMap(libzgw::ListMap::kBuckets);
-  objects_list_ = new libzgw::ListMap(libzgw::ListMap::kObjects);
+  libzgw::ListMapOptions list_options;
+  list_options.cache_bytes =
+    static_cast<uint64_t>(g_zgw_conf->name_list_cache_mb) << 20;
+  list_options.sync_flush = g_zgw_conf->name_list_sync_flush;
+  list_options.flush_interval_us = flush_interval_us_;
+  list_options.flush_mutations = g_zgw_conf->name_list_flush_mutations;
+  list_options.revalidate_us = g_zgw_conf->name_list_revalidate_ms * 1000ULL;
+  buckets_list_ = new libzgw::ListMap(libzgw::ListMap::kBuckets, list_options);
+  objects_list_ = new libzgw::ListMap(libzgw::ListMap::kObjects, list_options);
 }
 
 ZgwServer::~ZgwServer() {
@@ -57,26 +109,61 @@ ZgwServer::~ZgwServer() {
   delete zgw_admin_thread_;
   delete conn_factory_;
   delete admin_conn_factory_;
+  delete flush_store_;
+  delete cron_store_;
+  delete strip_gc_;
+  delete gc_store_;
+  delete strip_cache_;
+  delete meta_cache_;
+  delete user_table_;
+  delete mem_store_;
 
   LOG(INFO) << "ZgwServerThread " << pthread_self() << " exit!!!";
 }
 
-uint64_t ZgwServer::qps() {
+std::string ZgwServer::NewRequestId() {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "tx%021" PRIx64,
+           request_seq_.fetch_add(1, std::memory_order_relaxed));
+  return buf + request_id_suffix_;
+}
+
+void ZgwServer::UpdateQps() {
   uint64_t cur_time_us = slash::NowMicros();
-  slash::RWLock l(&qps_lock_, false);
-  uint64_t qps = (cur_query_num_ - last_query_num_) * 1000000
-    / (cur_time_us - last_time_us_ + 1);
-  if (qps == 0) {
-    cur_query_num_ = 0;
-  }
-  last_query_num_ = cur_query_num_;
+  uint64_t cur_query_num = metrics_.TotalRequests();
+  qps_.store((cur_query_num - last_query_num_) * 1000000
+             / (cur_time_us - last_time_us_ + 1));
+  last_query_num_ = cur_query_num;
   last_time_us_ = cur_time_us;
-  return qps;
 }
 
-void ZgwServer::AddQueryNum() {
-  slash::RWLock l(&qps_lock_, true);
-  ++cur_query_num_;
+void ZgwServer::KickFlusher() {
+  std::lock_guard<std::mutex> lock(flush_mutex_);
+  flush_kicked_ = true;
+  flush_cond_.notify_one();
+}
+
+void ZgwServer::FlushNameLists(bool force) {
+  Status s = buckets_list_->Flush(flush_store_, force);
+  if (!s.ok()) {
+    LOG(ERROR) << "Flush bucket name lists failed: " << s.ToString();
+  }
+  s = objects_list_->Flush(flush_store_, force);
+  if (!s.ok()) {
+    LOG(ERROR) << "Flush object name lists failed: " << s.ToString();
+  }
+}
+
+void ZgwServer::FlusherMain() {
+  std::unique_lock<std::mutex> lock(flush_mutex_);
+  while (!flusher_exit_) {
+    flush_cond_.wait_for(lock, std::chrono::microseconds(flush_interval_us_),
+                         [this] { return flush_kicked_ || flusher_exit_; });
+    flush_kicked_ = false;
+    lock.unlock();
+    FlushNameLists(false);
+    lock.lock();
+  }
 }
 
 void ZgwServer::Exit() {
@@ -88,6 +175,12 @@ void ZgwServer::Exit() {
 Status ZgwServer::Start() {
   Status s;
   LOG(INFO) << "Waiting for ZgwServerThread Init, maybe "<< worker_num_ * 10 << "s";
+
+  s = slow_log_.Open(g_zgw_conf->log_path + "/zgw_slow.log",
+                     g_zgw_conf->slow_request_ms);
+  if (!s.ok()) {
+    return s;
+  }
   
   if (zgw_dispatch_thread_->StartThread() != 0) {
     return Status::Corruption("Launch DispatchThread failed");
@@ -96,13 +189,47 @@ Status ZgwServer::Start() {
     return Status::Corruption("Launch AdminThread failed");
   }
 
+  libzgw::ZgwStoreOptions options = store_options_;
+  options.strip_io_window = 1;
+  options.strip_gc = NULL;
+  s = libzgw::ZgwStore::Open(options, &gc_store_);
+  if (!s.ok()) {
+    return s;
+  }
+  strip_gc_->Start(gc_store_);
+  s = libzgw::ZgwStore::Open(options, &flush_store_);
+  if (!s.ok()) {
+    return s;
+  }
+  s = libzgw::ZgwStore::Open(options, &cron_store_);
+  if (!s.ok()) {
+    return s;
+  }
+  flusher_ = std::thread(&ZgwServer::FlusherMain, this);
+
   LOG(INFO) << "ZgwServerThread Init Success!";
 
   while (running()) {
     // DoTimingTask
     slash::SleepForMicroseconds(kZgwCronInterval);
-    qps();
+    UpdateQps();
+    KickFlusher();
+    // Pick up users added through other gateways
+    s = cron_store_->LoadAllUsers();
+    if (!s.ok()) {
+      LOG(WARNING) << "Reload users failed: " << s.ToString();
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(flush_mutex_);
+    flusher_exit_ = true;
+    flush_cond_.notify_one();
   }
+  flusher_.join();
+  // Workers are stopped, save whatever is left
+  FlushNameLists(true);
+  strip_gc_->Stop();
 
   return Status::OK();
 }
@@ -3,6 +3,10 @@
 
 #include <string>
 #include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 #include <pthread.h>
 
 #include <glog/logging.h>
@@ -15,6 +19,8 @@
 #include "src/zgw_const.h"
 #include "src/zgw_conn.h"
 #include "src/zgw_admin_conn.h"
+#include "src/zgw_metrics.h"
+#include "src/zgw_slowlog.h"
 
 #include "src/zgw_config.h"
 
@@ -22,7 +28,8 @@ using slash::Status;
 
 class MyThreadEnvHandle : public pink::ThreadEnvHandle {
  public:
-  MyThreadEnvHandle() {
+  explicit MyThreadEnvHandle(const libzgw::ZgwStoreOptions& options)
+      : options_(options) {
   }
 
   virtual ~MyThreadEnvHandle() {
@@ -34,6 +41,7 @@ class MyThreadEnvHandle : public pink::ThreadEnvHandle {
   virtual int SetEnv(void** env) const;
 
  private:
+  libzgw::ZgwStoreOptions options_;
   mutable std::vector<libzgw::ZgwStore*> stores_;
 };
 
@@ -64,12 +72,40 @@ class ZgwServer {
   }
 
   Status UnrefBucketList(libzgw::ZgwStore* store, const std::string& access_key) {
-    return buckets_list_->Unref(store, access_key);
+    Status s = buckets_list_->Unref(store, access_key);
+    if (buckets_list_->flush_wanted()) {
+      KickFlusher();
+    }
+    return s;
   }
 
   Status UnrefObjectList(libzgw::ZgwStore* store,
                               const std::string& bucket_name) {
-    return objects_list_->Unref(store, bucket_name);
+    Status s = objects_list_->Unref(store, bucket_name);
+    if (objects_list_->flush_wanted()) {
+      KickFlusher();
+    }
+    return s;
+  }
+
+  libzgw::StripGc* strip_gc() {
+    return strip_gc_;
+  }
+
+  // NULL if disabled
+  libzgw::StripCache* strip_cache() {
+    return strip_cache_;
+  }
+
+  // NULL if disabled
+  libzgw::MetaCache* meta_cache() {
+    return meta_cache_;
+  }
+
+  void GetListMapStats(libzgw::ListMapStats* buckets,
+                       libzgw::ListMapStats* objects) {
+    buckets_list_->GetStats(buckets);
+    objects_list_->GetStats(objects);
   }
 
   void ObjectLock(const std::string& full_object_name) {
@@ -80,8 +116,21 @@ class ZgwServer {
     object_mutex_.Unlock(full_object_name);
   }
 
-  uint64_t qps();
-  void AddQueryNum();
+  // Requests per second over the last cron interval
+  uint64_t qps() const {
+    return qps_.load();
+  }
+
+  ZgwMetrics* metrics() {
+    return &metrics_;
+  }
+
+  SlowLog* slow_log() {
+    return &slow_log_;
+  }
+
+  // Unique across requests of this process and across restarts
+  std::string NewRequestId();
 
   bool running() const {
     return !should_exit_.load();
@@ -109,10 +158,42 @@ class ZgwServer {
   libzgw::ListMap* objects_list_;
   slash::RecordMutex object_mutex_;
 
+  // Users shared by all stores, reloaded by the cron loop
+  libzgw::ZgwUserTable* user_table_;
+  // All data when running without zeppelin, NULL otherwise
+  libzgw::MemStore* mem_store_;
+  libzgw::ZgwStoreOptions store_options_;
+  libzgw::ZgwStore* cron_store_;
+
+  // Strips of overwritten and deleted objects
+  libzgw::StripGc* strip_gc_;
+  libzgw::ZgwStore* gc_store_;
+  libzgw::StripCache* strip_cache_;
+  libzgw::MetaCache* meta_cache_;
+
+  // Name list write behind
+  libzgw::ZgwStore* flush_store_;
+  std::thread flusher_;
+  std::mutex flush_mutex_;
+  std::condition_variable flush_cond_;
+  bool flush_kicked_;
+  bool flusher_exit_;
+  uint64_t flush_interval_us_;
+
+  void KickFlusher();
+  void FlusherMain();
+  void FlushNameLists(bool force);
+
+  ZgwMetrics metrics_;
+  SlowLog slow_log_;
   uint64_t last_query_num_;
-  uint64_t cur_query_num_;
   uint64_t last_time_us_;
-  pthread_rwlock_t qps_lock_;
+  std::atomic<uint64_t> qps_;
+  std::atomic<uint64_t> request_seq_;
+  // Start time and pid
+  std::string request_id_suffix_;
+
+  void UpdateQps();
 };
 
 #endif
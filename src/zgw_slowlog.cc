@@ -0,0 +1,25 @@
+#include "src/zgw_slowlog.h"
+
+SlowLog::~SlowLog() {
+  if (file_ != NULL) {
+    fclose(file_);
+  }
+}
+
+Status SlowLog::Open(const std::string& path, int threshold_ms) {
+  if (threshold_ms <= 0) {
+    return Status::OK();
+  }
+  file_ = fopen(path.c_str(), "a");
+  if (file_ == NULL) {
+    return Status::IOError("Open slow log failed: " + path);
+  }
+  threshold_us_ = static_cast<uint64_t>(threshold_ms) * 1000;
+  return Status::OK();
+}
+
+void SlowLog::Write(const std::string& entry) {
+  std::lock_guard<std::mutex> lock(mu_);
+  fwrite(entry.data(), 1, entry.size(), file_);
+  fflush(file_);
+}
@@ -0,0 +1,46 @@
+#ifndef ZGW_SLOWLOG_H
+#define ZGW_SLOWLOG_H
+
+#include <cstdio>
+#include <string>
+#include <mutex>
+
+#include "slash/include/slash_status.h"
+
+using slash::Status;
+
+// Append only log of requests slower than a threshold, kept apart from
+// the glog files so it can be read without the noise
+class SlowLog {
+ public:
+  SlowLog()
+      : file_(NULL),
+        threshold_us_(0) {
+  }
+  ~SlowLog();
+
+  // threshold_ms 0 leaves the log disabled
+  Status Open(const std::string& path, int threshold_ms);
+
+  bool enabled() const {
+    return file_ != NULL;
+  }
+
+  uint64_t threshold_us() const {
+    return threshold_us_;
+  }
+
+  // entry is written as is, it should end with a newline
+  void Write(const std::string& entry);
+
+ private:
+  std::mutex mu_;
+  FILE* file_;
+  uint64_t threshold_us_;
+
+  // No copying allowed
+  SlowLog(const SlowLog&);
+  void operator=(const SlowLog&);
+};
+
+#endif
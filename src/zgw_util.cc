@@ -1,6 +1,8 @@
 #include "src/zgw_util.h"
 
 #include <sys/time.h>
+#include <string.h>
+#include <time.h>
 
 #include <openssl/md5.h>
 
@@ -30,6 +32,17 @@ std::string http_nowtime(time_t t) {
   return std::string(buf);
 }
 
+bool parse_http_time(const std::string& str, time_t* t) {
+  struct tm t_;
+  memset(&t_, 0, sizeof(t_));
+  const char* end = strptime(str.c_str(), "%a, %d %b %Y %H:%M:%S", &t_);
+  if (end == NULL) {
+    return false;
+  }
+  *t = timegm(&t_);
+  return true;
+}
+
 std::string md5(const std::string& content) {
   MD5_CTX md5_ctx;
   char buf[33] = {0};
@@ -66,3 +79,16 @@ void DumpHttpRequest(const pink::HttpRequest* req) {
   }
   DLOG(INFO) << "------------------------------------- ";
 } 
+
+bool PrefixSuccessor(const std::string& prefix, std::string* succ) {
+  *succ = prefix;
+  while (!succ->empty()) {
+    unsigned char c = succ->back();
+    if (c != 0xff) {
+      succ->back() = static_cast<char>(c + 1);
+      return true;
+    }
+    succ->pop_back();
+  }
+  return false;
+}
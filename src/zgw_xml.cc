@@ -31,6 +31,16 @@ std::string ErrorXml(ErrorType etype, const std::string& extra_info) {
       error->append_node(doc.allocate_node(node_element, "Code", "AccessDenied"));
       error->append_node(doc.allocate_node(node_element, "Message", "Access Denied"));
       break;
+    case PreconditionFailed:
+      error->append_node(doc.allocate_node(node_element, "Code", "PreconditionFailed"));
+      error->append_node(doc.allocate_node(node_element, "Message", "At least one of the "
+                                           "pre-conditions you specified did not hold"));
+      break;
+    case IncompleteBody:
+      error->append_node(doc.allocate_node(node_element, "Code", "IncompleteBody"));
+      error->append_node(doc.allocate_node(node_element, "Message", "The request body "
+                                           "is malformed or does not match its length."));
+      break;
     case InvalidRange:
       error->append_node(doc.allocate_node(node_element, "Code", "InvalidRange"));
       error->append_node(doc.allocate_node(node_element, "BucketName", extra_info.c_str()));
@@ -24,6 +24,8 @@ enum ErrorType {
   InvalidArgument,
   InvalidRange,
   AccessDenied,
+  IncompleteBody,
+  PreconditionFailed,
 };
 
 extern std::string ErrorXml(ErrorType etype, const std::string& extra_info = "");